@@ -0,0 +1,67 @@
+#include "adc.h"
+
+static uint8_t sChannels[ADC_MAX_CHANNELS];
+static uint8_t sChannelCount;
+static uint8_t sResultIndex;   // channel of the conversion just completed
+static uint8_t sPendingIndex;  // channel of the conversion now in progress
+static volatile int16_t sReadings[ADC_MAX_CHANNELS];  // by ADC channel number
+
+static uint8_t channel(uint8_t pin) {
+  return ((pin >= A0) ? pin - A0 : pin) & (ADC_MAX_CHANNELS - 1);
+}
+
+/***
+ * The pins are given as Arduino analogue pin numbers (A0, A1 ...).
+ */
+void adcScanInit(const uint8_t *pins, uint8_t count) {
+  adcScanStop();
+  if (count > ADC_MAX_CHANNELS) {
+    count = ADC_MAX_CHANNELS;
+  }
+  for (uint8_t i = 0; i < ADC_MAX_CHANNELS; i++) {
+    sReadings[i] = ADC_FULL_SCALE;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    sChannels[i] = channel(pins[i]);
+    // the digital input buffers only add noise on an analogue input
+    if (sChannels[i] < 6) {
+      bitSet(DIDR0, sChannels[i]);
+    }
+  }
+  sChannelCount = count;
+  sResultIndex = 0;
+  sPendingIndex = 0;
+  if (sChannelCount == 0) {
+    return;
+  }
+  // AVcc reference, as used by analogRead()
+  ADMUX = _BV(REFS0) | sChannels[0];
+  // free running mode, which also leaves AIN1 on the comparator
+  ADCSRB = 0;
+  // prescaler = 128, auto trigger, interrupt on completion
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  bitSet(ADCSRA, ADSC);
+}
+
+void adcScanStop() {
+  bitClear(ADCSRA, ADIE);
+  bitClear(ADCSRA, ADATE);
+}
+
+int16_t adcLatest(uint8_t pin) {
+  uint8_t oldSREG = SREG;
+  cli();
+  int16_t value = sReadings[channel(pin)];
+  SREG = oldSREG;
+  return value;
+}
+
+ISR(ADC_vect) {
+  int16_t value = ADC;
+  sReadings[sChannels[sResultIndex]] = value;
+  sResultIndex = sPendingIndex;
+  if (++sPendingIndex >= sChannelCount) {
+    sPendingIndex = 0;
+  }
+  ADMUX = _BV(REFS0) | sChannels[sPendingIndex];
+}
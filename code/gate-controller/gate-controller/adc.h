@@ -0,0 +1,46 @@
+#ifndef ADC_H
+#define ADC_H
+
+#include <Arduino.h>
+
+/***
+ * Interrupt driven ADC scanner for the analogue front panel buttons.
+ *
+ * analogRead() waits about 110us for each conversion. Four of them in
+ * the systick took nearly half a millisecond with interrupts masked,
+ * long enough to lose edges from the radio.
+ *
+ * Instead, the ADC runs in free-running mode so that a new conversion
+ * starts automatically as soon as the last one finishes. The
+ * conversion complete interrupt stores the result for its channel and
+ * moves the multiplexer on to the next one in the list. adcLatest()
+ * just returns the stored reading so the systick only has to compare
+ * numbers.
+ *
+ * The ADC clock is F_CPU/128. At 16MHz that is 125kHz, which is
+ * inside the 50-200kHz range needed for full 10 bit accuracy. There
+ * are 9615 conversions per second shared between the channels, far
+ * more than a button needs, and each interrupt takes a few
+ * microseconds.
+ *
+ * In free-running mode the next conversion has already started by
+ * the time the interrupt runs. A change to the multiplexer only takes
+ * effect for the conversion after that so the scanner keeps track of
+ * two channels - the one whose result has just arrived and the one
+ * that is in progress.
+ *
+ * Do not use analogRead() once the scanner is running. Until a pin
+ * has been read, adcLatest() returns ADC_FULL_SCALE.
+ */
+
+const uint8_t ADC_PRESCALER = 128;
+const uint8_t ADC_CLOCKS_PER_CONVERSION = 13;
+const uint32_t ADC_CONVERSION_RATE = F_CPU / ADC_PRESCALER / ADC_CLOCKS_PER_CONVERSION;
+const uint8_t ADC_MAX_CHANNELS = 8;
+const int16_t ADC_FULL_SCALE = 1023;
+
+void adcScanInit(const uint8_t *pins, uint8_t count);
+void adcScanStop();
+int16_t adcLatest(uint8_t pin);
+
+#endif
@@ -3,6 +3,8 @@
  */
 
 #include "button.h"
+#include "adc.h"
+#include "timestamp.h"
 #include <Arduino.h>
 
 
@@ -22,11 +24,15 @@ BasicButton::BasicButton(uint8_t buttonPin, uint8_t activeState, Type type) {
     pinMode(mPin, INPUT_PULLUP);
   }
   mState = 0;
+  mCount = 0;
+  mEdgeTime = 0;
+  mHead = 0;
+  mTail = 0;
 }
 
 bool BasicButton::isActive() {
   if (mType == ANALOG) {
-    bool active = analogRead(mPin) < 512;
+    bool active = adcLatest(mPin) < 512;
     return (mActiveState == ACTIVE_LOW) ? active : !active;
   } else {
     return digitalRead(mPin) == mActiveState;
@@ -34,14 +40,63 @@ bool BasicButton::isActive() {
 }
 
 void BasicButton::update() {
-  uint8_t newState = INACTIVE;
-  if (isActive()) {
-    newState = ACTIVE;
+  uint8_t level = isActive() ? ACTIVE : INACTIVE;
+  if (level == mState) {
+    if (mCount > 0) {
+      mCount--;
+    }
+    return;
   }
-  mState = newState;
+  if (mCount == 0) {
+    mEdgeTime = timestamp();
+  }
+  if (++mCount < DEBOUNCE_SAMPLES) {
+    return;
+  }
+  mCount = 0;
+  mState = level;
+  pushEvent(level == ACTIVE ? PRESS : RELEASE, mEdgeTime);
 }
 
 bool BasicButton::isPressed(void) {
   return mState == ACTIVE;
 }
 
+void BasicButton::pushEvent(uint8_t edge, uint32_t time) {
+  uint8_t head = mHead;
+  if ((uint8_t)(head - mTail) >= EVENT_QUEUE_SIZE) {
+    return;
+  }
+  Event &event = mEvents[head % EVENT_QUEUE_SIZE];
+  event.edge = edge;
+  event.time = time;
+  asm volatile("" ::: "memory");  // the event must be stored before it is published
+  mHead = head + 1;
+}
+
+bool BasicButton::getEvent(Event &event) {
+  uint8_t tail = mTail;
+  if (tail == mHead) {
+    return false;
+  }
+  asm volatile("" ::: "memory");
+  event = mEvents[tail % EVENT_QUEUE_SIZE];
+  mTail = tail + 1;
+  return true;
+}
+
+/***
+ * Empties the queue and returns true if there was a press in it, with
+ * the time of the first one.
+ */
+bool BasicButton::pressed(uint32_t &time) {
+  bool found = false;
+  Event event;
+  while (getEvent(event)) {
+    if (event.edge == PRESS && not found) {
+      time = event.time;
+      found = true;
+    }
+  }
+  return found;
+}
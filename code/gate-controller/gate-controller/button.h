@@ -9,10 +9,23 @@
  * not connected to digital ports.
  *
  * Consequently, they must be read as analogue values and
- * then rounded up or down to digital equivalents.
- *
- *
+ * then rounded up or down to digital equivalents. The readings come
+ * from the ADC scanner, which must be started before the first
+ * update().
+ * update() is called from the systick every 2ms. A change of level
+ * only counts once it has been seen on DEBOUNCE_SAMPLES more samples
+ * than not. The count goes down again while the contacts bounce back
+ * so a bounce does not start it again from scratch. When the change
+ * is accepted, a press or release event goes into a small queue with
+ * the timestamp() of the first sample that saw the new level. That
+ * is the time the button was pressed, not the time the loop got round
+ * to looking at it.
  *
+ * The loop takes events with getEvent() or, more usually, pressed()
+ * which empties the queue and says if there was a press and when.
+ * isPressed() is the debounced level for anything that still needs
+ * it. If the loop does not keep up, the oldest events are kept and
+ * new ones are dropped.
  */
 
 class BasicButton {
@@ -20,6 +33,15 @@ class BasicButton {
   enum ActiveState { ACTIVE_LOW = 0, ACTIVE_HIGH = 1 };
   enum State { INACTIVE = 0, ACTIVE = 1 };
   enum Type { DIGITAL = 0, ANALOG = 1};
+  enum Edge { RELEASE = 0, PRESS = 1 };
+
+  struct Event {
+    uint8_t edge;
+    uint32_t time;
+  };
+
+  static const uint8_t DEBOUNCE_SAMPLES = 3;
+  static const uint8_t EVENT_QUEUE_SIZE = 4;
 
   BasicButton(uint8_t buttonPin, uint8_t buttonMode = ACTIVE_LOW, Type type = DIGITAL);
 
@@ -28,11 +50,20 @@ class BasicButton {
   void update();
   bool isPressed();
   bool isActive();
+  bool getEvent(Event &event);
+  bool pressed(uint32_t &time);
  private:
+  void pushEvent(uint8_t edge, uint32_t time);
+
   uint8_t mPin;
   uint8_t mActiveState;
   volatile uint8_t mState;
   Type mType;
+  uint8_t mCount;
+  uint32_t mEdgeTime;
+  Event mEvents[EVENT_QUEUE_SIZE];
+  volatile uint8_t mHead;  // written only by update()
+  volatile uint8_t mTail;  // written only by the loop
 };
 
 #endif
@@ -0,0 +1,140 @@
+#include "command.h"
+
+const uint32_t VALUE_LIMIT = UINT32_MAX / 10;  // one more digit could overflow
+
+enum ParseState { IDLE, TYPE, VALUE, SKIP };
+
+static const Command *sTable;  // in PROGMEM
+static uint8_t sCount;
+static uint8_t sBareType;
+static ParseState sState;
+static uint16_t sType;
+static bool sHaveType;
+static uint32_t sValue;
+static bool sHaveNumber;
+static char sText[COMMAND_TEXT_SIZE + 1];
+static uint8_t sTextLength;
+static uint8_t sErrors;
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static bool isLetter(char c) {
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+}
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\r' || c == '\n';
+}
+
+static void startFrame() {
+  sState = TYPE;
+  sType = 0;
+  sHaveType = false;
+  sValue = 0;
+  sHaveNumber = false;
+  sTextLength = 0;
+}
+
+static void countError() {
+  if (sErrors < UINT8_MAX) {
+    sErrors++;
+  }
+}
+
+static CommandResult bad(char c) {
+  countError();
+  if (c == '<') {
+    startFrame();
+  } else {
+    sState = (c == '\r' || c == '\n') ? IDLE : SKIP;
+  }
+  return COMMAND_BAD;
+}
+
+void commandInit(const Command *table, uint8_t count, uint8_t bareType) {
+  sTable = table;
+  sCount = count;
+  sBareType = bareType;
+  sState = IDLE;
+  sErrors = 0;
+}
+
+static CommandResult dispatch() {
+  sState = IDLE;
+  sText[sTextLength] = 0;
+  for (uint8_t i = 0; i < sCount; i++) {
+    Command command;
+    memcpy_P(&command, &sTable[i], sizeof(command));
+    if (command.type == sType) {
+      if (command.handler(sValue, sText)) {
+        return COMMAND_DONE;
+      }
+      break;
+    }
+  }
+  countError();
+  return COMMAND_BAD;
+}
+
+/***
+ * Call with every character from the host that is not part of an
+ * acknowledgement. Returns COMMAND_DONE when a command has been
+ * carried out.
+ */
+CommandResult commandParse(char c) {
+  switch (sState) {
+    case IDLE:
+      if (c == '<') {
+        startFrame();
+        return COMMAND_PENDING;
+      }
+      if (c == '>') {
+        startFrame();
+        sType = sBareType;
+        return dispatch();
+      }
+      return isSpace(c) ? COMMAND_PENDING : bad(c);
+    case SKIP:
+      if (c == '<') {
+        startFrame();
+      } else if (c == '\r' || c == '\n') {
+        sState = IDLE;
+      }
+      return COMMAND_PENDING;
+    case TYPE:
+      if (isDigit(c) && sType < 100) {
+        sType = sType * 10 + (c - '0');
+        sHaveType = true;
+        return COMMAND_PENDING;
+      }
+      if (c == ',' && sHaveType && sType <= UINT8_MAX) {
+        sState = VALUE;
+        return COMMAND_PENDING;
+      }
+      return bad(c);
+    case VALUE:
+      if (c == '>' && (sHaveNumber || sTextLength > 0)) {
+        return dispatch();
+      }
+      if (isDigit(c) && sTextLength == 0) {
+        if (sValue > VALUE_LIMIT || (sValue == VALUE_LIMIT && c > '5')) {
+          return bad(c);
+        }
+        sValue = sValue * 10 + (c - '0');
+        sHaveNumber = true;
+        return COMMAND_PENDING;
+      }
+      if ((isLetter(c) || (isDigit(c) && sTextLength > 0)) && not sHaveNumber && sTextLength < COMMAND_TEXT_SIZE) {
+        sText[sTextLength++] = c;
+        return COMMAND_PENDING;
+      }
+      return bad(c);
+  }
+  return COMMAND_PENDING;
+}
+
+uint8_t commandErrors() {
+  return sErrors;
+}
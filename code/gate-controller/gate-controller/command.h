@@ -0,0 +1,50 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <Arduino.h>
+
+/***
+ * Commands from the host PC.
+ *
+ * The host sends commands in the same form as the messages it gets:
+ *
+ *   <type,value>
+ *
+ * where value is either a number or a word, such as TIMER in
+ * <99,TIMER>. Words may be up to COMMAND_TEXT_SIZE characters of
+ * letters, digits and '_' and must start with a letter. Spaces, CR
+ * and LF between commands are ignored.
+ *
+ * The original host software sends a '>' on its own to start a new
+ * mouse. A '>' between commands is still taken, as the command whose
+ * type is given to commandInit() as bareType, with the value 0.
+ *
+ * commandParse() takes one character at a time, as it arrives, and
+ * never waits for the rest of a command. Each character costs a few
+ * comparisons. When the '>' arrives, the type is looked up in a table
+ * of Command entries held in PROGMEM and the handler is called with
+ * the number, or with 0 and the word. A handler returns false if it
+ * does not accept the value.
+ *
+ * A frame that is badly formed, has an unknown type, or is refused by
+ * its handler returns COMMAND_BAD and is counted in commandErrors().
+ * After a bad character, everything up to the next '<' or line end is
+ * skipped. A '<' always starts a new command.
+ */
+
+const uint8_t COMMAND_TEXT_SIZE = 12;
+
+typedef bool (*CommandHandler)(uint32_t value, const char *text);
+
+struct Command {
+  uint8_t type;
+  CommandHandler handler;
+};
+
+enum CommandResult { COMMAND_PENDING, COMMAND_DONE, COMMAND_BAD };
+
+void commandInit(const Command *table, uint8_t count, uint8_t bareType);
+CommandResult commandParse(char c);
+uint8_t commandErrors();
+
+#endif
@@ -0,0 +1,195 @@
+#include "discipline.h"
+#include "timestamp.h"
+
+const uint32_t SECOND = 1000000UL;     // microseconds
+const uint32_t SECONDS_PER_DAY = 86400UL;
+const uint32_t HUNT_INTERVAL = 20000;  // between reads while looking for a rollover
+const uint32_t COARSE_GAP = 50000;     // a rollover this close is good enough to predict the next
+const uint32_t FINE_GAP = 4000;        // a rollover this close is good enough to measure
+const uint32_t CATCH_LEAD = 10000;     // start reading this long before a predicted rollover
+const uint32_t CATCH_LEAD_COARSE = 40000;
+const uint32_t CATCH_TIMEOUT = 30000;  // give up this long after it
+const int64_t PPB_PER_PPM = 1000;
+
+enum Phase { HUNT, WAIT, CATCH };
+
+static Phase sPhase = HUNT;
+static uint64_t sNextRead;
+
+static RtcTime sPrevious;  // the last reply and its time
+static uint64_t sPreviousAt;
+static bool sHavePrevious;
+
+static uint64_t sRollover;  // when the seconds last changed
+static bool sFine;
+
+static RtcTime sWall;  // the reading the wall clock counts from
+static uint64_t sWallAt;
+static bool sHaveWall;
+
+static bool sWindowOpen;
+static uint64_t sWindowStart;
+static uint32_t sWindowSecond;
+
+// the corrected clock is a straight line through the anchor
+static bool sLocked;
+static int32_t sPpb;
+static uint64_t sRawAnchor;
+static uint64_t sCorrectedAnchor;
+
+static uint32_t secondOfDay(const RtcTime &t) {
+  return t.second + 60UL * t.minute + 3600UL * t.hour;
+}
+
+static uint8_t daysInMonth(uint16_t year, uint8_t month) {
+  static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (month == 2 && year % 4 == 0) {
+    return 29;  // good until 2100
+  }
+  return (month >= 1 && month <= 12) ? days[month - 1] : 31;
+}
+
+static void advance(RtcTime &t, uint32_t seconds) {
+  seconds += secondOfDay(t);
+  uint32_t days = seconds / SECONDS_PER_DAY;
+  seconds %= SECONDS_PER_DAY;
+  t.hour = seconds / 3600;
+  t.minute = (seconds / 60) % 60;
+  t.second = seconds % 60;
+  while (days--) {
+    if (++t.day > daysInMonth(t.year, t.month)) {
+      t.day = 1;
+      if (++t.month > 12) {
+        t.month = 1;
+        t.year++;
+      }
+    }
+  }
+}
+
+uint64_t disciplineCorrect(uint64_t rawMicros) {
+  int64_t delta = (int64_t)(rawMicros - sRawAnchor);
+  // raw microseconds are (1 + error) corrected microseconds
+  return sCorrectedAnchor + delta - delta * sPpb / (SECOND * PPB_PER_PPM + sPpb);
+}
+
+uint64_t disciplinedMicros() {
+  return disciplineCorrect(timestampMicros());
+}
+
+static void setRate(int32_t ppb) {
+  uint64_t raw = timestampMicros();
+  sCorrectedAnchor = disciplineCorrect(raw);
+  sRawAnchor = raw;
+  sPpb = ppb;
+}
+
+/***
+ * Compare the time since the start of the window with the number of
+ * RTC seconds. A result beyond DISCIPLINE_LIMIT means the RTC was set
+ * or a rollover was misread so the window starts again.
+ */
+static bool measure(uint64_t at, const RtcTime &reading) {
+  uint32_t second = secondOfDay(reading);
+  uint32_t seconds = (second + SECONDS_PER_DAY - sWindowSecond) % SECONDS_PER_DAY;
+  if (sWindowOpen && seconds < DISCIPLINE_WINDOW) {
+    return false;
+  }
+  bool measured = false;
+  if (sWindowOpen) {
+    int64_t error = (int64_t)(at - sWindowStart) - (int64_t)seconds * SECOND;
+    int32_t ppb = error * PPB_PER_PPM / (int32_t)seconds;
+    if (ppb > -DISCIPLINE_LIMIT * PPB_PER_PPM && ppb < DISCIPLINE_LIMIT * PPB_PER_PPM) {
+      setRate(sLocked ? sPpb + (ppb - sPpb) / 4 : ppb);
+      sLocked = true;
+      measured = true;
+    }
+  }
+  sWindowOpen = true;
+  sWindowStart = at;
+  sWindowSecond = second;
+  return measured;
+}
+
+/***
+ * The seconds changed somewhere between the previous reply and this
+ * one so the best guess is half way between them.
+ */
+static bool rollover(uint64_t at, uint32_t gap, const RtcTime &reading) {
+  sRollover = at - gap / 2;
+  sWall = reading;
+  sWallAt = sRollover;
+  sHaveWall = true;
+  if (gap > COARSE_GAP) {
+    sFine = false;
+    sPhase = HUNT;
+    return false;
+  }
+  sPhase = WAIT;
+  sFine = gap <= FINE_GAP;
+  if (not sFine || not reading.valid) {
+    return false;
+  }
+  return measure(sRollover, reading);
+}
+
+static bool reply(const RtcTime &reading) {
+  uint64_t at = timestampMicrosAt(reading.ticks);
+  bool measured = false;
+  if (not sHaveWall) {
+    sWall = reading;
+    sWallAt = at;
+    sHaveWall = true;
+  }
+  if (sHavePrevious && reading.second != sPrevious.second) {
+    measured = rollover(at, (uint32_t)(at - sPreviousAt), reading);
+  }
+  sPrevious = reading;
+  sPreviousAt = at;
+  sHavePrevious = true;
+  return measured;
+}
+
+bool disciplineUpdate() {
+  bool measured = false;
+  RtcTime reading;
+  if (rtcNow(reading) && (not sHavePrevious || reading.ticks != sPrevious.ticks)) {
+    measured = reply(reading);
+  }
+  uint64_t now = timestampMicros();
+  // the next rollover is one RTC second on, as measured by this clock
+  uint64_t expected = sRollover + SECOND + sPpb / PPB_PER_PPM;
+  switch (sPhase) {
+    case HUNT:
+      if (now >= sNextRead && rtcRequest()) {
+        sNextRead = now + HUNT_INTERVAL;
+      }
+      break;
+    case WAIT:
+      if (now + (sFine ? CATCH_LEAD : CATCH_LEAD_COARSE) >= expected) {
+        sPhase = CATCH;
+      }
+      break;
+    case CATCH:
+      if (now > expected + CATCH_TIMEOUT) {
+        sPhase = HUNT;  // the RTC has stopped answering
+      } else {
+        rtcRequest();  // does nothing while the last read is still on the bus
+      }
+      break;
+  }
+  return measured;
+}
+
+int32_t disciplinePpm() {
+  return sPpb / PPB_PER_PPM;
+}
+
+bool disciplineWallClock(RtcTime &now) {
+  if (not sHaveWall) {
+    return false;
+  }
+  now = sWall;
+  advance(now, (disciplinedMicros() - disciplineCorrect(sWallAt)) / SECOND);
+  return true;
+}
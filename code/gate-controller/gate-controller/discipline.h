@@ -0,0 +1,51 @@
+#ifndef DISCIPLINE_H
+#define DISCIPLINE_H
+
+#include <Arduino.h>
+#include "rtc.h"
+
+/***
+ * Corrects the controller clock against the RTC.
+ *
+ * The Nano runs from a ceramic resonator which can be out by a few
+ * thousand ppm and drifts with temperature. 2000ppm is 0.6s in a five
+ * minute maze run. The PCF8563 runs from a 32.768kHz watch crystal
+ * which is good to a few tens of ppm so it is used as the reference.
+ *
+ * The CLKOUT pin of the RTC is not connected so the clock is measured
+ * through the seconds register. Just before the seconds are due to
+ * change, disciplineUpdate() reads the RTC back to back until they do.
+ * Each reply is timestamped in the TWI interrupt so the rollover is
+ * known to within the time of one read and an LCD run, about 3ms.
+ * For the rest of the second the bus is left to the LCD.
+ *
+ * Every DISCIPLINE_WINDOW seconds, the timestamp clock time between
+ * two rollovers gives the controller clock error. The first result is
+ * used as it is and later ones are averaged into it. disciplineUpdate()
+ * returns true when there is a new value for disciplinePpm(). A
+ * positive value means the controller clock is fast.
+ *
+ * disciplinedMicros() is timestampMicros() with the error taken out
+ * and it is the clock used by the stopwatches. disciplineCorrect()
+ * does the same for a time from timestampMicrosAt(), such as a gate
+ * event or a button press. A new measurement changes the rate of the
+ * corrected clock from then on, it never makes it jump.
+ *
+ * The rollovers also keep a local copy of the wall clock.
+ * disciplineWallClock() gives the last RTC reading advanced by the
+ * corrected clock without going to the bus.
+ *
+ * Without an RTC there is no correction. Call disciplineUpdate() on
+ * every pass of the loop.
+ */
+
+const uint8_t DISCIPLINE_WINDOW = 64;       // seconds
+const uint16_t DISCIPLINE_LIMIT = 10000;    // ppm, anything more is a bad reading
+
+bool disciplineUpdate();
+int32_t disciplinePpm();
+uint64_t disciplinedMicros();
+uint64_t disciplineCorrect(uint64_t rawMicros);
+bool disciplineWallClock(RtcTime &now);
+
+#endif
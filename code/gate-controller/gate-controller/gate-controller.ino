@@ -3,26 +3,30 @@
  * Gate Controller
  * (c) Peter Harrison 2020
  * Libraries:
- * https://bitbucket.org/fmalpartida/new-liquidcrystal/wiki/Home
- * https://platformio.org/lib/show/136/LiquidCrystal
- *
- * https://github.com/NeiroNx/RTCLib
- * https://platformio.org/lib/show/1197/RTCLib
+ * https://platformio.org/lib/show/161/SD
  *
+ * The LCD and the RTC share the I2C bus and have their own interrupt
+ * driven drivers in lcd.cpp, rtc.cpp and twi.cpp.
  *
  *
  */
 #include <Arduino.h>
-#include <LiquidCrystal_I2C.h>
-#include <SoftwareSerial.h>
-#include <Wire.h>
 #include <avr/wdt.h>
-#include <sdcard.h>
-#include "RTClib.h"
+#include "adc.h"
 #include "button.h"
+#include "command.h"
+#include "discipline.h"
+#include "hostlink.h"
+#include "journal.h"
+#include "lcd.h"
 #include "messages.h"
 #include "pins.h"
+#include "receiver.h"
+#include "rtc.h"
+#include "screen.h"
 #include "stopwatch.h"
+#include "timestamp.h"
+#include "twi.h"
 #include "utils.h"
 
 ///////////////////////////////////////////////////////////////////
@@ -33,6 +37,8 @@ BasicButton startButton(BUTTON_START, BasicButton::ACTIVE_LOW, BasicButton::ANAL
 BasicButton goalButton(BUTTON_GOAL, BasicButton::ACTIVE_LOW, BasicButton::ANALOG);
 BasicButton armButton(BUTTON_ARM, BasicButton::ACTIVE_LOW, BasicButton::ANALOG);
 BasicButton resetButton(BUTTON_RESET, BasicButton::ACTIVE_LOW, BasicButton::ANALOG);
+// read in the background by the ADC scanner
+const uint8_t analog_buttons[] = {BUTTON_START, BUTTON_GOAL, BUTTON_ARM, BUTTON_RESET};
 
 const uint8_t BTN_NONE = 0;
 const uint8_t BTN_GREEN = 1;
@@ -58,30 +64,19 @@ uint16_t g_watchdog_id;
  * address. Thus, bridging all the links would make the addresses
  * 0x20 and 0x38 respectively.
  *
- * Also note that the LiquidCrystal_I2C library, like many Arduino
- * sketches/libraries, uses a right-justified address.
- */
-// I2C LCD pin numbers are on the extender chip - not the arduino
-LiquidCrystal_I2C lcd(0x3f, 2, 1, 0, 4, 5, 6, 7, 3, POSITIVE);
-
-/***
- * The PCF8563 library expects a left-justified address. Hence the
- * multiplication by two in the constructor
- */
-PCF8563 rtc(0x51 * 2);
-
-/***
- * The radio is used only in receive mode here but the SoftwareSerial requires
- * two pins for the configuration. TX is not used
+ * Also note that the I2C drivers, like many Arduino sketches and
+ * libraries, use a right-justified address.
  */
-SoftwareSerial radio(RADIO_RX, RADIO_TX);  // RX, TX
+I2cLcd lcd(0x3f);
+// everything else writes to the LCD through the shadow framebuffer
+Screen screen(lcd);
 
 Stopwatch mazeTimer;
 Stopwatch runTimer;
 uint32_t g_maze_time;
 uint32_t g_run_time;
 uint32_t g_run_start_time;
-uint32_t g_maze_start_time;
+uint64_t g_maze_start_time;
 uint32_t bestTime = UINT32_MAX;
 int runCount = 0;
 
@@ -199,27 +194,27 @@ void buttonsUpdate() {
 /*********************************************** BUTTONS END ******************/
 
 void show_trial_screen() {
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print(F("TRIAL      Run:"));
-  lcd.setCursor(0, 1);
-  lcd.print(F("Trial Time"));
-  lcd.setCursor(0, 2);
-  lcd.print(F("  Run Time"));
-  lcd.setCursor(0, 3);
-  lcd.print(F(" Best Time"));
+  screen.clear();
+  screen.setCursor(0, 0);
+  screen.print(F("TRIAL      Run:"));
+  screen.setCursor(0, 1);
+  screen.print(F("Trial Time"));
+  screen.setCursor(0, 2);
+  screen.print(F("  Run Time"));
+  screen.setCursor(0, 3);
+  screen.print(F(" Best Time"));
 }
 
 void showMazeScreen() {
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print(F("MAZE       Run:"));
-  lcd.setCursor(0, 1);
-  lcd.print(F("Maze Time"));
-  lcd.setCursor(0, 2);
-  lcd.print(F(" Run Time"));
-  lcd.setCursor(0, 3);
-  lcd.print(F("Best Time"));
+  screen.clear();
+  screen.setCursor(0, 0);
+  screen.print(F("MAZE       Run:"));
+  screen.setCursor(0, 1);
+  screen.print(F("Maze Time"));
+  screen.setCursor(0, 2);
+  screen.print(F(" Run Time"));
+  screen.setCursor(0, 3);
+  screen.print(F("Best Time"));
 }
 
 /*********************************************** systick ******************/
@@ -247,14 +242,37 @@ inline void systick() {
   buttonsUpdate();
 }
 
-// the systick event is an ISR attached to Timer 2
+/***
+ * The systick event is an ISR attached to Timer 2. Its length is
+ * measured on the timestamp clock every time and the longest is sent
+ * to the host as MSG_SystickWorst. It holds off the radio capture
+ * interrupt for that long, which test_receiver shows must stay under
+ * about 50us.
+ */
+volatile uint16_t systick_worst = 0;  // timestamp ticks
+
 ISR(TIMER2_COMPA_vect) {
+  uint16_t start = TCNT1;
   systick();
+  uint16_t elapsed = TCNT1 - start;
+  if (elapsed > systick_worst) {
+    systick_worst = elapsed;
+  }
+}
+
+uint16_t systick_worst_us() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t worst = systick_worst;
+  SREG = oldSREG;
+  return worst / TIMESTAMP_TICKS_PER_US;
 }
 /*********************************************** systick  end******************/
 
 void set_state(int new_state) {
   contestState = new_state;
+  journalState(new_state);
+  journalSync();
   const __FlashStringHelper *comment = F("");
   switch (contestState) {
     case ST_CALIBRATE:
@@ -288,82 +306,379 @@ void set_state(int new_state) {
 
 /*********************************************** process radio data ***/
 
+/***
+ * A gate packet, as described in the gate detector protocol.md, is
+ *
+ *   *GNSSSDDDDC#
+ *
+ * G is the gate - 'A' for the start gate, 'a' for the start cell
+ * (home) sensor and 'B'-'P' for the goal gates. N is the sequence
+ * number of the packet, SSS the sensor level and DDDD the delay in
+ * units of 10us. C is a check character.
+ *
+ * The '*' is only there to wake up the receiver and is often lost so
+ * the reader just keeps the last few characters. When a '#' arrives,
+ * the ten characters before it are checked. The receiver gives the
+ * time at which the stop bit of the '#' ended and the packet started
+ * PACKET_CHARS character times before that. Each packet of an event
+ * gives the same event time since they are sent at exact intervals
+ * after the event.
+ *
+ * The event time is worked out in timestamp() ticks, on the same
+ * clock as the character times, so it does not matter how long the
+ * character waited in the receive queue. The state machines get it
+ * as a timestampMicros() time, which event_time() corrects for the
+ * stopwatches.
+ *
+ * Every event is sent PACKET_REPEATS times. The first good packet is
+ * reported straight away so there is no extra delay. Later packets
+ * whose event time is within DUPLICATE_WINDOW of the last event from
+ * the same kind of gate are repeats of it.
+ *
+ * Each repeat gives its own estimate of the event time and they are
+ * fused by taking the median. A packet with a damaged delay that
+ * still passes the check character is an outlier and does not move
+ * the median once there are three or more packets. The confidence is
+ * the number of estimates within FUSION_TOLERANCE of the median.
+ * While the event is waiting for the state machine, gate_message_time
+ * and gate_message_confidence follow the fused estimate. Once it has
+ * been used, the timers keep the time they were given.
+ */
+
 // also used for gate ID
-enum ReaderState { RD_NONE, RD_WAIT, RD_CONFIRM, RD_HOME, RD_START, RD_GOAL, RD_TERM, RD_TRIGGERED, RD_ERROR };
+enum ReaderState { RD_NONE, RD_WAIT, RD_HOME, RD_START, RD_GOAL, RD_TRIGGERED, RD_ERROR };
+
+const uint8_t PACKET_CHARS = 12;
+const uint8_t PACKET_BODY = 10;                  // G through C
+const uint32_t PACKET_REPEAT_INTERVAL = 50000;  // microseconds
+const uint8_t PACKET_REPEATS = 10;
+const uint32_t DUPLICATE_WINDOW = 100;  // milliseconds
+const uint32_t FUSION_TOLERANCE = 100;  // microseconds
+
+struct EventFusion {
+  uint32_t first;  // timestamp() estimate from the first packet
+  int32_t offsets[PACKET_REPEATS];
+  uint8_t count;
+  uint32_t time;  // fused timestamp()
+  uint8_t confidence;
+};
 
 volatile ReaderState reader_state = RD_WAIT;
-uint32_t gate_message_time;
-int retry_count;
+uint64_t gate_message_time;  // microseconds
+char packet[PACKET_BODY];
+uint32_t packet_arrival[PACKET_BODY];
+uint8_t packet_length = 0;
+uint8_t gate_message_confidence;
+EventFusion event_fusion[3];  // for RD_HOME, RD_START and RD_GOAL
+int fusion_updated = RD_NONE;
 int gate_id = 0;
 char last_char = '*';
 
-void gate_reader(char c) {
+// the packet body, less the check character, folded down to four bits
+bool packet_check(const char *p) {
+  uint8_t x = 0;
+  for (uint8_t i = 0; i < PACKET_BODY - 1; i++) {
+    x ^= p[i];
+  }
+  return p[PACKET_BODY - 1] == 'a' + ((x ^ (x >> 4)) & 0x0F);
+}
+
+int packet_gate(char g) {
+  if (g == 'A') {
+    return RD_START;
+  }
+  if (g == 'a') {
+    return RD_HOME;
+  }
+  if (g > 'A' && g <= 'P') {
+    return RD_GOAL;
+  }
+  return RD_NONE;
+}
+
+int packet_number(const char *p, uint8_t digits) {
+  int n = 0;
+  while (digits--) {
+    if (not isdigit(*p)) {
+      return -1;
+    }
+    n = 10 * n + (*p++ - '0');
+  }
+  return n;
+}
+
+/***
+ * Every detector times its characters, its repeats and the delay field
+ * from its own clock. A ceramic resonator can be out by 0.5% which
+ * would put the last repeat of an event 2.7ms adrift if the controller
+ * assumed the nominal rates.
+ *
+ * The time from the G of a packet to its '#' is ten of the gate's
+ * character periods measured on the controller's clock. Each gate
+ * keeps a running average of that period in 1/256 tick units.
+ * Measurements more than 2% from nominal cannot be a clean packet and
+ * are ignored. The average is used to find the start of each packet
+ * and to scale the repeat interval and delay back to the event.
+ *
+ * The estimate for a gate is reported to the PC with each new event
+ * from it as parts per million from nominal, in MSG_GatePpm.
+ */
+const uint8_t GATE_CLOCKS = 17;  // 'A'-'P' and 'a'
+const uint32_t NOMINAL_PERIOD = 256UL * RX_CHAR_TICKS;
+const uint32_t PERIOD_LIMIT = NOMINAL_PERIOD / 50;
+
+struct GateClock {
+  uint32_t period;  // 1/256 ticks per character
+  uint8_t count;
+};
+
+GateClock gate_clock[GATE_CLOCKS];
+
+int gate_clock_index(char g) {
+  return g == 'a' ? GATE_CLOCKS - 1 : g - 'A';
+}
+
+// the character period of a gate, nominal until it has been measured
+uint32_t gate_period(int index) {
+  return gate_clock[index].count ? gate_clock[index].period : NOMINAL_PERIOD;
+}
+
+// span is the time from the end of the G to the end of the '#'
+void gate_clock_update(int index, uint32_t span) {
+  if (span > 2UL * PACKET_BODY * RX_CHAR_TICKS) {
+    return;
+  }
+  uint32_t measured = span * 256 / PACKET_BODY;
+  if (measured + PERIOD_LIMIT < NOMINAL_PERIOD || measured > NOMINAL_PERIOD + PERIOD_LIMIT) {
+    return;
+  }
+  GateClock &g = gate_clock[index];
+  if (g.count == 0) {
+    g.period = measured;
+  } else {
+    g.period += (int32_t)(measured - g.period) / 16;
+  }
+  if (g.count < UINT8_MAX) {
+    g.count++;
+  }
+}
+
+// 1/256 tick per character is just under 1ppm
+int32_t period_ppm(int32_t period) {
+  return period * 125 / 128;
+}
+
+void report_gate_clock(char g) {
+  int32_t error = (int32_t)(gate_period(gate_clock_index(g)) - NOMINAL_PERIOD);
+  send_signed_message(MSG_GatePpm, period_ppm(error), F(" GATE PPM"), g);
+}
+
+// add an estimate to an event and work out the median and confidence
+void fuse_event_time(int kind, uint32_t estimate) {
+  EventFusion &f = event_fusion[kind];
+  if (f.count < PACKET_REPEATS) {
+    f.offsets[f.count++] = estimate - f.first;
+  }
+  int32_t sorted[PACKET_REPEATS];
+  uint8_t n = f.count;
+  for (uint8_t i = 0; i < n; i++) {
+    int32_t v = f.offsets[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > v) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = v;
+  }
+  int32_t median = (n & 1) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  f.time = f.first + median;
+  f.confidence = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    if (labs(sorted[i] - median) <= (int32_t)(FUSION_TOLERANCE * TIMESTAMP_TICKS_PER_US)) {
+      f.confidence++;
+    }
+  }
+}
+
+// arrival is the timestamp() at the end of the stop bit of c
+void gate_reader(char c, uint32_t arrival) {
   if (not isprint(c)) {
     return;
   }
-  uint32_t time = millis();
-  switch (reader_state) {
-    case RD_WAIT:
-      retry_count = 0;
-      if (c >= '0' and c < '0' + 10) {
-        last_char = c;
-        gate_id = RD_GOAL;
-        reader_state = RD_CONFIRM;
-      } else if (c >= 'a' and c < 'a' + 10) {
-        last_char = c;
-        gate_id = RD_START;
-        reader_state = RD_CONFIRM;
-
-      } else if (c >= 'A' and c < 'A' + 10) {
-        last_char = c;
-        gate_id = RD_HOME;
-        reader_state = RD_CONFIRM;
-      }
+  if (c != '#') {
+    if (packet_length == PACKET_BODY) {
+      memmove(packet, packet + 1, PACKET_BODY - 1);
+      memmove(packet_arrival, packet_arrival + 1, (PACKET_BODY - 1) * sizeof(uint32_t));
+      packet_length--;
+    }
+    packet_arrival[packet_length] = arrival;
+    packet[packet_length++] = c;
+    return;
+  }
+  bool complete = packet_length == PACKET_BODY;
+  packet_length = 0;
+  if (not complete || not packet_check(packet)) {
+    return;
+  }
+  int gate = packet_gate(packet[0]);
+  int sequence = packet_number(packet + 1, 1);
+  int delay = packet_number(packet + 5, 4);
+  if (gate == RD_NONE || sequence < 0 || delay < 0) {
+    return;
+  }
+  const uint32_t ticks_per_ms = 1000UL * TIMESTAMP_TICKS_PER_US;
+  int clock = gate_clock_index(packet[0]);
+  gate_clock_update(clock, arrival - packet_arrival[0]);
+  uint32_t period = gate_period(clock);
+  uint32_t start = arrival - (PACKET_CHARS * period + 128) / 256;
+  uint32_t nominal = (sequence * PACKET_REPEAT_INTERVAL + (uint32_t)delay * 10) * TIMESTAMP_TICKS_PER_US;
+  int32_t correction = (int64_t)nominal * (int32_t)(period - NOMINAL_PERIOD) / (int32_t)NOMINAL_PERIOD;
+  uint32_t estimate = start - nominal - correction;
+  EventFusion &f = event_fusion[gate - RD_HOME];
+  const uint32_t window = DUPLICATE_WINDOW * ticks_per_ms;
+  bool repeat = f.count > 0 && f.count < PACKET_REPEATS && (uint32_t)(estimate - f.time + window) <= 2 * window;
+  if (not repeat) {
+    f.first = estimate;
+    f.count = 0;
+  }
+  fuse_event_time(gate - RD_HOME, estimate);
+  fusion_updated = gate;
+  journalEvent(packet[0], f.confidence, f.time);
+  uint64_t event = timestampMicrosAt(f.time);
+  if (repeat) {
+    // refine the event if the state machine has not used it yet
+    if (reader_state == gate && gate_id == gate) {
+      gate_message_time = event;
+      gate_message_confidence = f.confidence;
+    }
+    return;
+  }
+  report_gate_clock(packet[0]);
+  // a new event stays pending until acknowledged by the timer state machine
+  if (reader_state != RD_WAIT) {
+    return;
+  }
+  last_char = packet[0];
+  gate_id = gate;
+  gate_message_time = event;
+  gate_message_confidence = f.confidence;
+  reader_state = (ReaderState)gate;
+}
+
+/*********************************************** host commands ************/
+bool command_new_mouse(uint32_t value, const char *text) {
+  set_state(ST_NEW_MOUSE);
+  return true;
+}
+
+// TIMER goes back to timing with a new mouse, CALIBRATION stops timing
+bool command_set_mode(uint32_t value, const char *text) {
+  if (strcmp_P(text, PSTR("TIMER")) == 0) {
+    set_state(ST_NEW_MOUSE);
+    return true;
+  }
+  if (strcmp_P(text, PSTR("CALIBRATION")) == 0) {
+    set_state(ST_CALIBRATE);
+    return true;
+  }
+  return false;
+}
+
+const Command host_commands[] PROGMEM = {
+    {MSG_NewMouse, command_new_mouse},
+    {MSG_SetMode, command_set_mode},
+};
+
+/***
+ * Everything the host has sent is taken on each pass. Acknowledgements
+ * go to the host link and the rest to the command parser, so each
+ * character costs a few comparisons unless it completes a command.
+ */
+void read_host() {
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (not hostReceive(c) && commandParse(c) == COMMAND_BAD) {
+      send_message(MSG_BadCommand, commandErrors(), F(" BAD COMMAND"));
+    }
+  }
+}
+
+// the controller clock error measured against the RTC
+void report_controller_clock() {
+  send_signed_message(MSG_ClockPpm, disciplinePpm(), F(" CLOCK PPM"));
+}
+
+/***
+ * The diagnostic counts go to the host one at a time, after each
+ * watchdog, so they never fill the message queue.
+ */
+int diagnostic_phase = 0;
+
+void report_diagnostics() {
+  switch (diagnostic_phase++) {
+    case 0:
+      send_message(MSG_HostWorstSend, hostWorstSend(), F(" HOST WORST SEND US"));
       break;
-    case RD_CONFIRM:
-
-      if (c >= last_char && c < last_char + 6) {
-        if (gate_id == RD_GOAL) {
-          gate_message_time = time - 2 * (c - '0');
-        } else if (gate_id == RD_START) {
-          gate_message_time = time - 2 * (c - 'a');
-        } else if (gate_id == RD_HOME) {
-          gate_message_time = time - 2 * (c - 'A');
-        } else {
-          gate_message_time = time;  // this is an error
-        }
-        reader_state = RD_TERM;
-      } else {
-        if (++retry_count > 6) {
-          gate_id = RD_NONE;
-          reader_state = RD_WAIT;
-        }
-      }
-    case RD_TERM:
-      // if (c == '#') {
-      if (gate_id == RD_HOME) {
-        reader_state = RD_HOME;
-      } else if (gate_id == RD_START) {
-        reader_state = RD_START;
-      } else if (gate_id == RD_GOAL) {
-        reader_state = RD_GOAL;
-      } else {
-        reader_state = RD_WAIT;
-      }
+    case 1:
+      send_message(MSG_HostDropped, hostDropped(), F(" HOST DROPPED"));
       break;
-      // }
-    case RD_HOME:
-    case RD_START:
-    case RD_GOAL:
-      // stay in this state until acknowledged by the timer state machine
+    case 2:
+      send_message(MSG_HostLost, hostLost(), F(" HOST LOST"));
+      break;
+    case 3:
+      send_message(MSG_RxOverruns, rxOverruns(), F(" RADIO OVERRUNS"));
+      break;
+    case 4:
+      send_message(MSG_RxFraming, rxFramingErrors(), F(" RADIO FRAMING"));
+      break;
+    case 5:
+      send_message(MSG_ScreenWorst, screen.worstStall(), F(" SCREEN WORST US"));
+      break;
+    case 6:
+      send_message(MSG_ScreenOver, screen.overBudget(), F(" SCREEN OVER BUDGET"));
+      break;
+    case 7:
+      send_message(MSG_JournalWorst, journalWorstUpdate(), F(" JOURNAL WORST US"));
+      break;
+    case 8:
+      send_message(MSG_JournalDrops, journalDropped(), F(" JOURNAL DROPPED"));
       break;
     default:
-      reader_state = RD_ERROR;
-      gate_id = RD_NONE;
+      send_message(MSG_SystickWorst, systick_worst_us(), F(" SYSTICK WORST US"));
+      diagnostic_phase = 0;
       break;
   }
 }
 
+/***
+ * Gate events are timed from the packet. Button presses are timed
+ * from the edge seen by the systick. Both end up in microseconds on
+ * the stopwatch clock, corrected against the RTC.
+ */
+uint64_t event_time(bool from_gate, uint32_t press_time) {
+  return disciplineCorrect(from_gate ? gate_message_time : timestampMicrosAt(press_time));
+}
+
+/***
+ * The state machines take every button event on each pass. A press
+ * that means nothing in the current state is thrown away rather than
+ * being left to act later. Holding a button down does nothing more
+ * so there is no need to wait for it to be released.
+ */
+struct ButtonPresses {
+  bool start, goal, arm, reset;
+  uint32_t start_time, goal_time, arm_time, reset_time;
+};
+
+ButtonPresses presses;
+
+void read_button_presses() {
+  presses.start = startButton.pressed(presses.start_time);
+  presses.goal = goalButton.pressed(presses.goal_time);
+  presses.arm = armButton.pressed(presses.arm_time);
+  presses.reset = resetButton.pressed(presses.reset_time);
+}
+
 /*********************************************** time display functions ***/
 
 /***
@@ -386,61 +701,65 @@ void showTime(int column, int line, uint32_t time) {
   *p++ = '0' + (ms / 100) % 10;
   *p++ = '0' + (ms / 10) % 10;
   *p++ = '0' + (ms / 1) % 10;
-  lcd.setCursor(column, line);
-  lcd.print(lineBuffer);
+  screen.setCursor(column, line);
+  screen.print(lineBuffer);
 }
 
+// shows the local copy of the RTC time, which needs no I2C read
 void showSystemTime(int column, int line) {
-  DateTime now = rtc.now();
+  RtcTime now;
+  if (not disciplineWallClock(now)) {
+    return;
+  }
   char lineBuffer[24];
-  strncpy(lineBuffer, "DD.MM.YYYY  hh:mm:ss\0", sizeof(lineBuffer));
-  lcd.setCursor(column, line);
-  lcd.print(now.format(lineBuffer));
+  screen.setCursor(column, line);
+  screen.print(rtcFormat(lineBuffer, now));
 }
 
 /*********************************************** maze state machine *********/
 void showState() {
-  lcd.setCursor(0, 0);
+  screen.setCursor(0, 0);
   switch (contestState) {
     case ST_CALIBRATE:
-      lcd.print(F("CALIBRATE"));
+      screen.print(F("CALIBRATE"));
       break;
     case ST_NEW_MOUSE:
-      lcd.print(F("INIT     "));
+      screen.print(F("INIT     "));
       break;
     case ST_WAITING:
-      lcd.print(F("WAITING  "));
+      screen.print(F("WAITING  "));
       break;
     case ST_ARMED:
-      lcd.print(F("ARMED    "));
+      screen.print(F("ARMED    "));
       break;
     case ST_STARTING:
-      lcd.print(F("STARTING "));
+      screen.print(F("STARTING "));
       break;
     case ST_RUNNING:
-      lcd.print(F("RUNNING  "));
+      screen.print(F("RUNNING  "));
       break;
     case ST_GOAL:
-      lcd.print(F("GOAL     "));
+      screen.print(F("GOAL     "));
       break;
     default:
-      lcd.print(F("---------"));
+      screen.print(F("---------"));
       break;
   }
 }
 
 void displayInit() {
-  lcd.setCursor(11, 3);
-  lcd.print(F("--:--.---"));
-  lcd.setCursor(17, 0);
-  lcd.print(F("  "));
+  screen.setCursor(11, 3);
+  screen.print(F("--:--.---"));
+  screen.setCursor(17, 0);
+  screen.print(F("  "));
 }
 
 ///////////////////////////////////////////////////////////////////
 
 int old_state = 0;
 void trial_machine() {
-  if (resetButton.isPressed()) {
+  read_button_presses();
+  if (presses.reset) {
     set_state(ST_NEW_MOUSE);
     send_message(MSG_NewMouse, 0, F(" NEW MOUSE"));
     send_maze_time(0);
@@ -472,15 +791,16 @@ void trial_machine() {
       break;
 
     case ST_ARMED:  // robot in start cell, ready to run
-      if (startButton.isPressed() || gate == RD_START) {
+      if (presses.start || gate == RD_START) {
+        uint64_t time = event_time(gate == RD_START, presses.start_time);
         bestTime = UINT32_MAX;
         if (runCount == 0) {
           send_maze_time(0);
-          mazeTimer.restart();
-          g_maze_start_time = millis();
+          mazeTimer.restart(time);
+          g_maze_start_time = time;
         }
         send_split_time(0);
-        runTimer.restart();
+        runTimer.restart(time);
         runCount++;
         set_state(ST_RUNNING);
       }
@@ -489,19 +809,20 @@ void trial_machine() {
       if (runTimer.time() < TIME_TRIAL_LOCKOUT) {
         break;
       }
-      if (startButton.isPressed() || gate == RD_START) {
-        runTimer.stop();
+      if (presses.start || gate == RD_START) {
+        uint64_t time = event_time(gate == RD_START, presses.start_time);
+        runTimer.stop(time);
         g_run_time = runTimer.time();
         if (g_run_time < bestTime) {
           bestTime = g_run_time;
         }
         runCount++;
-        runTimer.restart();
+        runTimer.restart(time);
         send_run_time(g_run_time);
         send_split_time(0);
         set_state(ST_GOAL);
       }
-      if (armButton.isPressed()) {
+      if (presses.arm) {
         runTimer.restart();
         set_state(ST_ARMED);
       }
@@ -522,13 +843,11 @@ void trial_machine() {
 ///////////////////////////////////////////////////////////////////
 
 void mazeMachine() {
-  if (resetButton.isPressed()) {
+  read_button_presses();
+  if (presses.reset) {
     set_state(ST_NEW_MOUSE);
     send_message(MSG_NewMouse, 0, F(" NEW MOUSE"));
     send_maze_time(0);
-    while (resetButton.isPressed()) {
-      delay(10);
-    }
   }
   int gate = GATE_NONE;
   if (reader_state == RD_HOME) {
@@ -558,38 +877,32 @@ void mazeMachine() {
       break;
     case ST_WAITING:
       // if (armButton.isPressed() || (reader_state == RD_HOME)) {
-      if (armButton.isPressed() || gate == GATE_ARM) {
+      if (presses.arm || gate == GATE_ARM) {
         set_state(ST_ARMED);
         if (runCount == 0) {
           send_maze_time(0);
-          mazeTimer.restart();
+          mazeTimer.restart(event_time(gate == GATE_ARM, presses.arm_time));
         }
         reader_state = RD_WAIT;
-        while (armButton.isPressed()) {
-          // delay(2);
-        }
       }
       break;
     case ST_ARMED:  // robot in start cell, ready to run
       // if (startButton.isPressed() || reader_state != RD_NONE) {
-      if (startButton.isPressed() || gate == GATE_START) {
+      if (presses.start || gate == GATE_START) {
         set_state(ST_RUNNING);
         send_split_time(0);
-        runTimer.restart();
+        runTimer.restart(event_time(gate == GATE_START, presses.start_time));
         runCount++;
         reader_state = RD_WAIT;
-        while (startButton.isPressed()) {
-          delay(2);
-        }
       }
       break;
     case ST_RUNNING:  // robot on its way to the goal
-      if (goalButton.isPressed() || gate == GATE_GOAL) {
+      if (presses.goal || gate == GATE_GOAL) {
         // robot arrives at goal
         if (runTimer.time() < 500) {
           break;  /////////////////////////////////////// NASTY HACK
         }
-        runTimer.stop();
+        runTimer.stop(event_time(gate == GATE_GOAL, presses.goal_time));
         uint32_t time = runTimer.time();
         set_state(ST_GOAL);
         send_run_time(time);
@@ -601,26 +914,20 @@ void mazeMachine() {
         reader_state = RD_WAIT;
         // break;
       }
-      if (armButton.isPressed() || gate == GATE_ARM) {
+      if (presses.arm || gate == GATE_ARM) {
         // robot is back in start cell or run is aborted
         runTimer.stop();
         runTimer.reset();
         set_state(ST_ARMED);
         reader_state = RD_WAIT;
-        while (armButton.isPressed()) {
-          delay(2);
-        }
       }
       break;
     case ST_GOAL:
-      if (armButton.isPressed() || gate == GATE_ARM) {
+      if (presses.arm || gate == GATE_ARM) {
         // robot is back in start cell or run is aborted
         set_state(ST_ARMED);
         // send_message(MSG_Watchdog, millis(), F(" timecheck"));
         reader_state = RD_WAIT;
-        while (armButton.isPressed()) {
-          delay(2);
-        }
       }
       break;
     default:
@@ -631,22 +938,22 @@ void mazeMachine() {
 void radio_test(char c) {
   switch (reader_state) {
     case RD_HOME:
-      Serial.println(F("HOME    "));
-      lcd.setCursor(0, 1);
-      lcd.print(F("HOME    "));
+      send_message(MSG_CTrigger, 1, F(" HOME"));
+      screen.setCursor(0, 1);
+      screen.print(F("HOME    "));
       reader_state = RD_WAIT;
       break;
 
     case RD_START:
-      Serial.println(F("START    "));
-      lcd.setCursor(0, 1);
-      lcd.print(F("START    "));
+      send_message(MSG_STrigger, 1, F(" START"));
+      screen.setCursor(0, 1);
+      screen.print(F("START    "));
       reader_state = RD_WAIT;
       break;
     case RD_GOAL:
-      Serial.println(F("GOAL    "));
-      lcd.setCursor(0, 1);
-      lcd.print(F("GOAL    "));
+      send_message(MSG_FTrigger, 1, F(" GOAL"));
+      screen.setCursor(0, 1);
+      screen.print(F("GOAL    "));
       reader_state = RD_WAIT;
       break;
     default:
@@ -654,18 +961,30 @@ void radio_test(char c) {
       // reader_state = RD_WAIT;
       break;
   }
+  // how many of the packets received so far agree on the event time
+  if (fusion_updated != RD_NONE) {
+    const EventFusion &f = event_fusion[fusion_updated - RD_HOME];
+    screen.setCursor(0, 2);
+    screen.print(F("AGREE "));
+    screen.print(f.confidence);
+    screen.print('/');
+    screen.print(f.count);
+    screen.print(F("   "));
+    fusion_updated = RD_NONE;
+  }
 }
 
 int select_contest_type() {
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print(F(" CONTEST TIMER V0.2 "));
-  lcd.setCursor(0, 1);
-  lcd.print(F(" GREEN: MAZE EVENT  "));
-  lcd.setCursor(0, 2);
-  lcd.print(F("YELLOW: TIME TRIAL  "));
-  lcd.setCursor(0, 3);
-  lcd.print(F("   RED: RADIO TEST  "));
+  screen.clear();
+  screen.setCursor(0, 0);
+  screen.print(F(" CONTEST TIMER V0.2 "));
+  screen.setCursor(0, 1);
+  screen.print(F(" GREEN: MAZE EVENT  "));
+  screen.setCursor(0, 2);
+  screen.print(F("YELLOW: TIME TRIAL  "));
+  screen.setCursor(0, 3);
+  screen.print(F("   RED: RADIO TEST  "));
+  screen.refresh();
   while (button_state != BTN_NONE) {
     delay(50);
   }
@@ -681,7 +1000,8 @@ int select_contest_type() {
   } else if (button_state == BTN_RED) {
     type = CT_RADIO;
   }
-  lcd.clear();
+  screen.clear();
+  screen.refresh();
   while (button_state != BTN_NONE) {
     delay(100);
   }
@@ -699,14 +1019,15 @@ void setup() {
   pinMode(ENC_A, INPUT_PULLUP);
   pinMode(ENC_B, INPUT_PULLUP);
 
-  Serial.begin(9600);
+  hostInit(HOST_BAUD, HOST_TEXT);
+  commandInit(host_commands, sizeof(host_commands) / sizeof(host_commands[0]), MSG_NewMouse);
   while (!Serial) {
     ;  // Needed for native USB port only
   }
   Serial.println(F("CONTEST_ TIMER V0.2"));
 
-  Wire.begin();
-  lcd.begin(20, 4);  //(backlight is on)
+  twiInit();
+  lcd.begin();  //(backlight is on)
   lcd.createChar(0, c0);
   lcd.createChar(1, c1);
   lcd.createChar(2, c2);
@@ -715,25 +1036,40 @@ void setup() {
   lcd.createChar(5, c5);
   lcd.createChar(6, c6);
   lcd.createChar(7, c7);
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print(F("SD card ... "));
+  screen.begin();
+  screen.setCursor(0, 0);
+  screen.print(F("RTC ...     "));
+  screen.refresh();
+  // the RTC readings are timestamped
+  timestampInit();
+  RtcTime now;
+  if (rtcInit() && rtcNow(now)) {
+    screen.print(F("Done"));
+    char buf[24];
+    Serial.println(rtcFormat(buf, now));
+  } else {
+    screen.print(F("None"));
+  }
+
+  // after the RTC so the journal file gets the right date
+  screen.setCursor(0, 1);
+  screen.print(F("SD card ... "));
+  screen.refresh();
   Serial.println(F("Initialising SD card"));
-  sdCardInit(SD_SELECT, SD_DETECT);
-  lcd.print(F("Done"));
-
-  lcd.setCursor(0, 1);
-  lcd.print(F("RTC ...     "));
-  rtc.begin();
-  lcd.print(F("Done"));
-  char buf[32];
-  Serial.println(rtc.now().tostr(buf));
-  lcd.setCursor(0, 2);
-  lcd.print(F("RADIO ...   "));
-  radio.begin(5000);
-  lcd.print(F("Done"));
+  if (journalInit(SD_SELECT)) {
+    screen.print(F("Done"));
+  } else {
+    screen.print(F("None"));
+  }
+  screen.setCursor(0, 2);
+  screen.print(F("RADIO ...   "));
+  screen.refresh();
+  rxInit();
+  screen.print(F("Done"));
+  screen.refresh();
   delay(500);
 
+  adcScanInit(analog_buttons, sizeof(analog_buttons));
   setupSystick();
   delay(100);
   if (button_state != BTN_NONE) {
@@ -750,14 +1086,14 @@ void setup() {
       show_trial_screen();
       break;
     default:
-      lcd.clear();
-      lcd.print(F("NO CONTEST TYPE"));
+      screen.clear();
+      screen.print(F("NO CONTEST TYPE"));
       break;
   }
 
-  while (radio.available()) {
-    radio.read();  // flush the input buffer
-  }
+  // forget the presses used to choose the contest
+  read_button_presses();
+  rxFlush();
   contestState = ST_NEW_MOUSE;
   send_message(MSG_NewMouse, 0, F(" NEW MOUSE"));
   g_watchdog_time = millis();
@@ -775,23 +1111,27 @@ void setup() {
 int display_phase = 0;
 
 void loop() {
-  char c;
-  if (radio.available()) {
-    c = radio.read();
-    gate_reader(c);
+  char c = 0;
+  uint32_t arrival;
+  while (rxRead(c, arrival)) {
+    journalRadio(c, arrival);
+    gate_reader(c, arrival);
   }
-
-  if (Serial.available()) {
-    char c = Serial.read();
-    if (c == '>') {
-      set_state(ST_NEW_MOUSE);
-    }
+  if (disciplineUpdate()) {
+    report_controller_clock();
   }
+
+  read_host();
   if (button_state == (BTN_BLUE + BTN_GREEN)) {
     while (button_state != BTN_NONE) {
       // delay(10);
     }
-    lcd.clear();
+    screen.clear();
+    screen.refresh();
+    while (not hostIdle()) {
+      hostUpdate();
+    }
+    Serial.flush();
     reset_processor();
   }
   if (contest_type == CT_MAZE) {
@@ -807,8 +1147,8 @@ void loop() {
     displayUpdateTime += displayUpdateInterval;
     switch (display_phase++) {
       case 0:
-        lcd.setCursor(17, 0);
-        lcd.print(runCount);
+        screen.setCursor(17, 0);
+        screen.print(runCount);
         break;
       case 1:
         showTime(11, 1, mazeTimer.time());
@@ -830,5 +1170,10 @@ void loop() {
   if (millis() - g_watchdog_time > watchdog_interval) {
     g_watchdog_time = millis();
     send_message(MSG_Watchdog, g_watchdog_id++, F(" WATCHDOG"));
+    report_diagnostics();
   }
+  hostUpdate();
+  journalUpdate();
+  twiCheck();
+  screen.update();
 }
@@ -0,0 +1,393 @@
+#include "hostlink.h"
+#include "discipline.h"
+#include "timestamp.h"
+
+const uint8_t HOST_QUEUE_MASK = HOST_QUEUE_SIZE - 1;
+static_assert((HOST_QUEUE_SIZE & HOST_QUEUE_MASK) == 0, "queue size must be a power of two");
+const uint8_t HOST_PENDING_MASK = HOST_PENDING - 1;
+static_assert((HOST_PENDING & HOST_PENDING_MASK) == 0, "pending size must be a power of two");
+static_assert(256 % HOST_WINDOW == 0, "the window must divide the sequence numbers");
+
+const uint8_t BINARY_PAYLOAD = 13;
+const uint8_t BINARY_FRAME = 2 + 1 + BINARY_PAYLOAD + 1;
+const uint8_t TEXT_FRAME = 48;  // must fit in the Serial transmit buffer
+const uint8_t MAX_FRAME = TEXT_FRAME > BINARY_FRAME ? TEXT_FRAME : BINARY_FRAME;
+const uint8_t TYPE_ACK = 0x80;  // in a binary frame
+
+struct HostMessage {
+  uint8_t type;
+  uint8_t sequence;
+  char extra;
+  bool reliable;
+  bool isSigned;
+  uint32_t value;
+  uint32_t ticks;  // timestamp() when it was sent
+  const __FlashStringHelper *comment;
+};
+
+// a message waiting for the host to acknowledge it
+struct Unacked {
+  HostMessage message;
+  uint32_t due;  // millis() of the next send
+  uint8_t sends;
+  bool used;
+};
+
+static HostMessage sQueue[HOST_QUEUE_SIZE];
+static uint8_t sHead;
+static uint8_t sTail;
+static uint8_t sSequence;
+static uint8_t sReliableSequence;
+static bool sAcking;  // the host has said that it acknowledges
+static uint8_t sDropped;
+static uint8_t sLost;
+static Unacked sWindow[HOST_WINDOW];
+static HostMessage sPending[HOST_PENDING];  // reliable messages waiting for room
+static uint8_t sPendingHead;
+static uint8_t sPendingTail;
+static bool sInAck;  // part way through an acknowledgement from the host
+static uint8_t sAckDigits;
+static uint16_t sAckSequence;
+static uint16_t sWorstSend;
+static HostFormat sFormat;
+
+static uint8_t sFrame[MAX_FRAME];
+static uint8_t sFrameLength;  // zero when there is nothing waiting to go
+
+static uint8_t crc8(const uint8_t *data, uint8_t length) {
+  uint8_t crc = 0;
+  while (length--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint8_t *putLittle(uint8_t *p, uint64_t value, uint8_t bytes) {
+  while (bytes--) {
+    *p++ = (uint8_t)value;
+    value >>= 8;
+  }
+  return p;
+}
+
+static uint8_t buildBinary(const HostMessage &m) {
+  uint8_t *p = sFrame;
+  *p++ = HOST_SYNC0;
+  *p++ = HOST_SYNC1;
+  *p++ = BINARY_PAYLOAD;
+  *p++ = m.sequence;
+  *p++ = m.reliable ? m.type | TYPE_ACK : m.type;
+  p = putLittle(p, m.value, 4);
+  p = putLittle(p, disciplineCorrect(timestampMicrosAt(m.ticks)), 6);
+  *p++ = m.extra;
+  *p = crc8(sFrame + 2, 1 + BINARY_PAYLOAD);
+  return BINARY_FRAME;
+}
+
+static char *putNumber(char *p, uint32_t value) {
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+// long comments are cut short to leave room for the CR LF
+static uint8_t buildText(const HostMessage &m) {
+  char *p = (char *)sFrame;
+  char *end = (char *)sFrame + TEXT_FRAME - 2;
+  *p++ = '<';
+  p = putNumber(p, m.type);
+  *p++ = ',';
+  if (m.isSigned && (int32_t)m.value < 0) {
+    *p++ = '-';
+    p = putNumber(p, -(uint32_t)m.value);
+  } else {
+    p = putNumber(p, m.value);
+  }
+  *p++ = '>';
+  if (m.reliable) {
+    *p++ = '#';
+    p = putNumber(p, m.sequence);
+  }
+  if (m.extra) {
+    *p++ = ' ';
+    *p++ = m.extra;
+  }
+  if (m.comment) {
+    const char *c = reinterpret_cast<const char *>(m.comment);
+    char ch;
+    while (p < end && (ch = pgm_read_byte(c++)) != 0) {
+      *p++ = ch;
+    }
+  }
+  *p++ = '\r';
+  *p++ = '\n';
+  return p - (char *)sFrame;
+}
+
+void hostInit(uint32_t baud, HostFormat format) {
+  Serial.begin(baud);
+  sFormat = format;
+  sHead = 0;
+  sTail = 0;
+  sFrameLength = 0;
+  sPendingHead = 0;
+  sPendingTail = 0;
+  for (uint8_t i = 0; i < HOST_WINDOW; i++) {
+    sWindow[i].used = false;
+  }
+  sDropped = 0;
+  sLost = 0;
+  sAcking = false;
+}
+
+// takes effect from the next message to be formatted
+void hostSetFormat(HostFormat format) {
+  sFormat = format;
+}
+
+static bool enqueue(const HostMessage &m) {
+  if ((uint8_t)(sHead - sTail) >= HOST_QUEUE_SIZE) {
+    return false;
+  }
+  sQueue[sHead & HOST_QUEUE_MASK] = m;
+  sHead++;
+  return true;
+}
+
+static void fill(HostMessage &m, uint8_t sequence, uint8_t type, uint32_t value, const __FlashStringHelper *comment, char extra,
+                 uint32_t ticks) {
+  m.type = type;
+  m.sequence = sequence;
+  m.extra = extra;
+  m.reliable = false;
+  m.isSigned = false;
+  m.value = value;
+  m.ticks = ticks;
+  m.comment = comment;
+}
+
+static void worstSend(uint32_t start) {
+  uint16_t elapsed = (timestamp() - start) / TIMESTAMP_TICKS_PER_US;
+  if (elapsed > sWorstSend) {
+    sWorstSend = elapsed;
+  }
+}
+
+static void countDropped() {
+  if (sDropped < UINT8_MAX) {
+    sDropped++;
+  }
+}
+
+static void countLost() {
+  if (sLost < UINT8_MAX) {
+    sLost++;
+  }
+}
+
+static bool sendMessage(uint8_t type, uint32_t value, const __FlashStringHelper *comment, char extra, bool isSigned) {
+  uint32_t start = timestamp();
+  HostMessage m;
+  fill(m, sSequence++, type, value, comment, extra, start);
+  m.isSigned = isSigned;
+  bool queued = enqueue(m);
+  if (not queued) {
+    countDropped();
+  }
+  worstSend(start);
+  return queued;
+}
+
+/***
+ * Returns false if the queue was full and the message was dropped.
+ */
+bool hostSend(uint8_t type, uint32_t value, const __FlashStringHelper *comment, char extra) {
+  return sendMessage(type, value, comment, extra, false);
+}
+
+bool hostSendSigned(uint8_t type, int32_t value, const __FlashStringHelper *comment, char extra) {
+  return sendMessage(type, (uint32_t)value, comment, extra, true);
+}
+
+/***
+ * Move the waiting reliable messages on, in order, as far as there is
+ * room. Until the host has said that it acknowledges, they go to the
+ * queue like any other message. After that, message n goes in window
+ * slot n % HOST_WINDOW, so the window slides over the sequence numbers
+ * and a message that is slow to be acknowledged holds up the ones
+ * HOST_WINDOW after it. A message that gets a slot but does not fit in
+ * the queue straight away is sent by resend().
+ */
+static void admit() {
+  while (sPendingTail != sPendingHead) {
+    HostMessage &m = sPending[sPendingTail & HOST_PENDING_MASK];
+    if (not sAcking) {
+      m.sequence = sSequence;
+      if (not enqueue(m)) {
+        return;
+      }
+      sSequence++;
+    } else {
+      Unacked *slot = &sWindow[sReliableSequence % HOST_WINDOW];
+      if (slot->used) {
+        return;
+      }
+      slot->message = m;
+      slot->message.sequence = sReliableSequence++;
+      slot->message.reliable = true;
+      slot->used = true;
+      slot->sends = 0;
+      slot->due = millis();
+      if (enqueue(slot->message)) {
+        slot->sends = 1;
+        slot->due += HOST_ACK_TIMEOUT;
+      }
+    }
+    sPendingTail++;
+  }
+}
+
+/***
+ * Returns false only if HOST_PENDING messages were already waiting for
+ * room, in which case the message is given up and counted as lost.
+ */
+bool hostSendReliable(uint8_t type, uint32_t value, const __FlashStringHelper *comment) {
+  uint32_t start = timestamp();
+  bool taken = (uint8_t)(sPendingHead - sPendingTail) < HOST_PENDING;
+  if (taken) {
+    fill(sPending[sPendingHead & HOST_PENDING_MASK], 0, type, value, comment, 0, start);
+    sPendingHead++;
+    admit();
+  } else {
+    countLost();
+  }
+  worstSend(start);
+  return taken;
+}
+
+static void acknowledge(uint16_t sequence) {
+  for (uint8_t i = 0; i < HOST_WINDOW; i++) {
+    if (sWindow[i].used && sWindow[i].message.sequence == sequence) {
+      sWindow[i].used = false;
+    }
+  }
+}
+
+/***
+ * Pass every character from the host through here. An
+ * acknowledgement is '!', up to three digits and a CR or LF. With no
+ * digits it turns acknowledgements on. Returns false for anything that
+ * is not part of one so the caller can deal with it.
+ */
+bool hostReceive(char c) {
+  if (c == '!') {
+    sInAck = true;
+    sAckDigits = 0;
+    sAckSequence = 0;
+    return true;
+  }
+  if (not sInAck) {
+    return false;
+  }
+  if (c >= '0' && c <= '9' && sAckDigits < 3) {
+    sAckSequence = sAckSequence * 10 + (c - '0');
+    sAckDigits++;
+    return true;
+  }
+  sInAck = false;
+  if (c != '\r' && c != '\n') {
+    return false;
+  }
+  sAcking = true;
+  if (sAckDigits > 0) {
+    acknowledge(sAckSequence);
+  }
+  return true;
+}
+
+// send again anything that has waited too long for its acknowledgement
+static void resend() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < HOST_WINDOW; i++) {
+    Unacked &u = sWindow[i];
+    if (not u.used || (int32_t)(now - u.due) < 0) {
+      continue;
+    }
+    if (u.sends >= HOST_TRIES) {
+      u.used = false;
+      countLost();
+      continue;
+    }
+    if (not enqueue(u.message)) {
+      return;
+    }
+    uint16_t timeout = HOST_ACK_TIMEOUT;
+    for (uint8_t n = 0; n < u.sends && timeout < HOST_MAX_TIMEOUT; n++) {
+      timeout *= 2;
+    }
+    if (timeout > HOST_MAX_TIMEOUT) {
+      timeout = HOST_MAX_TIMEOUT;
+    }
+    u.sends++;
+    u.due = now + timeout;
+  }
+}
+
+/***
+ * Call as often as possible from loop(). Writes as many whole frames
+ * as there is room for and never waits for the serial port.
+ */
+void hostUpdate() {
+  resend();
+  admit();
+  while (true) {
+    if (sFrameLength == 0) {
+      if (sHead == sTail) {
+        return;
+      }
+      const HostMessage &m = sQueue[sTail & HOST_QUEUE_MASK];
+      sFrameLength = (sFormat == HOST_BINARY) ? buildBinary(m) : buildText(m);
+      sTail++;
+    }
+    if (Serial.availableForWrite() < sFrameLength) {
+      return;
+    }
+    Serial.write(sFrame, sFrameLength);
+    sFrameLength = 0;
+  }
+}
+
+// true when everything sent has gone to the Serial transmit buffer
+bool hostIdle() {
+  return sFrameLength == 0 && sHead == sTail;
+}
+
+uint8_t hostUnacked() {
+  uint8_t count = sPendingHead - sPendingTail;
+  for (uint8_t i = 0; i < HOST_WINDOW; i++) {
+    count += sWindow[i].used;
+  }
+  return count;
+}
+
+uint8_t hostDropped() {
+  return sDropped;
+}
+
+uint8_t hostLost() {
+  return sLost;
+}
+
+uint16_t hostWorstSend() {
+  return sWorstSend;
+}
@@ -0,0 +1,123 @@
+#ifndef HOSTLINK_H
+#define HOSTLINK_H
+
+#include <Arduino.h>
+
+/***
+ * Queued messages to the host PC.
+ *
+ * send_message() used to print each message straight to Serial. With
+ * the transmit buffer full, every print waited for the UART, and at
+ * 9600 baud a state change could hold up the loop for tens of
+ * milliseconds just when a gate event was due.
+ *
+ * hostSend() now only copies the message into a queue along with its
+ * timestamp() and a sequence number. It never formats anything and
+ * never waits. The longest time it has taken is kept in
+ * hostWorstSend(), in microseconds. hostUpdate() is called from the
+ * loop. It formats the message at the head of the queue and writes
+ * it once the whole frame fits in the Serial transmit buffer, so a
+ * frame is never split by other output. If the queue is full, the
+ * message is dropped and counted in hostDropped(). The sequence
+ * number still goes up so the host can see the gap.
+ *
+ * Run results go through hostSendReliable() instead. The existing host
+ * software never acknowledges anything, so until the host sends
+ *
+ *   ! CR LF
+ *
+ * these are sent once, like hostSend(). A host that does
+ * acknowledge sends that line when it connects and again after every
+ * watchdog, so that it is heard again after the controller restarts.
+ * From then on each reliable message is kept in a window of
+ * HOST_WINDOW slots and sent again, with the same sequence number,
+ * until the host acknowledges it by sending
+ *
+ *   !sequence CR LF
+ *
+ * with the sequence number in decimal. The first retry is after
+ * HOST_ACK_TIMEOUT and each later one waits twice as long, up to
+ * HOST_MAX_TIMEOUT. After HOST_TRIES sends the message is given up
+ * and counted in hostLost(). Nothing ever waits for an
+ * acknowledgement. hostReceive() is given every character from the
+ * host and returns true if it was part of an acknowledgement.
+ *
+ * A reliable message is never dropped because the window or the queue
+ * is full. It waits in a list of HOST_PENDING messages and hostUpdate()
+ * moves it on as soon as there is room, keeping the time at which it
+ * was sent. Only if that list is full too is it given up, counted in
+ * hostLost() and hostSendReliable() returns false. hostUnacked()
+ * counts the waiting messages along with those in the window.
+ *
+ * Reliable messages have their own sequence numbers, apart from the
+ * other messages. They count up by one, with no gaps, for each
+ * reliable message taken into the window and wrap from 255 to 0.
+ * Sequence s + HOST_WINDOW is not used until s has been acknowledged
+ * or given up, so while s is still being sent no number past
+ * s + HOST_WINDOW - 1 has been used. To take
+ * each result exactly once the host keeps the numbers it has taken
+ * and ignores one it has already taken. Whenever it takes a new s it
+ * forgets s + HOST_WINDOW to s + 128, which have not been sent yet
+ * this time round.
+ *
+ * There are two formats. HOST_TEXT is the original
+ *
+ *   <type,value> comment CR LF
+ *
+ * which the existing host software reads. A message that needs an
+ * acknowledgement has its sequence number after the '>', as in
+ * <13,12345>#42 RUN TIME. Without acknowledgements it is <13,12345> RUN TIME
+ * as before.
+ *
+ * HOST_BINARY sends each message as a 17 byte frame, little endian:
+ *
+ *   0xA5 0x5A   sync
+ *   length      13, the bytes from sequence to extra
+ *   sequence    counts every message sent, including dropped ones,
+ *               or the reliable sequence number if the type has the
+ *               top bit set
+ *   type        the MSG_ number, with the top bit set if it needs
+ *               an acknowledgement
+ *   value       4 bytes
+ *   time        6 bytes, microseconds on the corrected controller clock
+ *   extra       the gate character for MSG_CURRENT_STATE, otherwise 0
+ *   crc         CRC-8, polynomial 0x07, of length to extra
+ *
+ * The sync bytes and CRC are the same as the detector telemetry. The
+ * only text outside the frames is the banner printed by setup() before
+ * the format can be changed.
+ *
+ * Most values are unsigned. hostSendSigned() is for the few, such as
+ * clock errors, that can be negative. The text format prints them
+ * with a minus sign and the binary format sends them as 32 bit two's
+ * complement. messages.h says which types are signed.
+ *
+ * None of these may be called from an interrupt.
+ */
+
+enum HostFormat { HOST_TEXT, HOST_BINARY };
+
+const uint32_t HOST_BAUD = 115200;
+const uint8_t HOST_QUEUE_SIZE = 8;
+const uint8_t HOST_WINDOW = 4;
+const uint8_t HOST_PENDING = 4;
+const uint8_t HOST_TRIES = 8;
+const uint16_t HOST_ACK_TIMEOUT = 250;   // milliseconds
+const uint16_t HOST_MAX_TIMEOUT = 4000;  // milliseconds
+const uint8_t HOST_SYNC0 = 0xA5;
+const uint8_t HOST_SYNC1 = 0x5A;
+
+void hostInit(uint32_t baud, HostFormat format);
+void hostSetFormat(HostFormat format);
+bool hostSend(uint8_t type, uint32_t value, const __FlashStringHelper *comment = nullptr, char extra = 0);
+bool hostSendSigned(uint8_t type, int32_t value, const __FlashStringHelper *comment = nullptr, char extra = 0);
+bool hostSendReliable(uint8_t type, uint32_t value, const __FlashStringHelper *comment = nullptr);
+bool hostReceive(char c);
+void hostUpdate();
+bool hostIdle();
+uint8_t hostUnacked();
+uint8_t hostDropped();
+uint8_t hostLost();
+uint16_t hostWorstSend();
+
+#endif
@@ -0,0 +1,257 @@
+#include "journal.h"
+#include <SD.h>
+#include "discipline.h"
+#include "rtc.h"
+#include "timestamp.h"
+
+const uint16_t BLOCK_SIZE = 512;
+const uint8_t HEADER_SIZE = 2 + 2 + 4 + 4 + 6 + 6;
+const uint8_t SPILL_SIZE = 96;  // records from the pass in which the block filled
+const uint16_t MAX_FILES = 10000;
+
+static Sd2Card sCard;
+static SdVolume sVolume;
+static SdFile sRoot;
+static SdFile sFile;
+
+static uint8_t *sBlock;  // the SdVolume cache
+static uint8_t sSpill[SPILL_SIZE];
+static uint8_t sSpillLength;
+static bool sReady;
+static bool sFull;
+static uint16_t sFileNumber;
+static uint32_t sFirstBlock;  // on the card
+static uint32_t sBlockNumber;  // in the journal
+static uint32_t sErased;       // journal blocks before this are erased
+static uint16_t sLength;       // bytes used in the block
+static uint16_t sWritten;      // bytes of the block already on the card
+static bool sSyncRequested;
+static uint32_t sSyncTime;  // millis() of the last write
+static uint16_t sDropped;
+static uint16_t sWorstUpdate;
+
+static uint8_t *putLittle(uint8_t *p, uint64_t value, uint8_t bytes) {
+  while (bytes--) {
+    *p++ = (uint8_t)value;
+    value >>= 8;
+  }
+  return p;
+}
+
+static void startBlock() {
+  memset(sBlock, 0, BLOCK_SIZE);
+  uint8_t *p = sBlock;
+  *p++ = 'J';
+  *p++ = 'L';
+  p = putLittle(p, sFileNumber, 2);
+  p = putLittle(p, sBlockNumber, 4);
+  uint32_t ticks = timestamp();
+  p = putLittle(p, ticks, 4);
+  p = putLittle(p, disciplineCorrect(timestampMicrosAt(ticks)), 6);
+  RtcTime now;
+  if (disciplineWallClock(now) || rtcNow(now)) {
+    *p++ = now.year - 2000;
+    *p++ = now.month;
+    *p++ = now.day;
+    *p++ = now.hour;
+    *p++ = now.minute;
+    *p++ = now.second;
+  }
+  sLength = HEADER_SIZE;
+  sWritten = 0;
+  // anything that arrived while the last block was waiting to go
+  memcpy(sBlock + sLength, sSpill, sSpillLength);
+  sLength += sSpillLength;
+  sSpillLength = 0;
+  sFull = false;
+}
+
+// dates for the directory entry
+static void fileTime(uint16_t *date, uint16_t *time) {
+  RtcTime now;
+  if (not rtcNow(now)) {
+    *date = FAT_DATE(2000, 1, 1);
+    *time = 0;
+    return;
+  }
+  *date = FAT_DATE(now.year, now.month, now.day);
+  *time = FAT_TIME(now.hour, now.minute, now.second);
+}
+
+/***
+ * Waits for the card so it is for setup() only. Returns false if
+ * there is no card, no room for a new journal or the card will not
+ * erase the start of the run, in which case everything else does
+ * nothing.
+ */
+bool journalInit(uint8_t chipSelect) {
+  sReady = false;
+  if (not sCard.init(SPI_FULL_SPEED, chipSelect) || not sVolume.init(&sCard) || not sRoot.openRoot(&sVolume)) {
+    return false;
+  }
+  SdFile::dateTimeCallback(fileTime);
+  char name[] = "JRNL0000.BIN";
+  for (sFileNumber = 0; sFileNumber < MAX_FILES; sFileNumber++) {
+    uint16_t n = sFileNumber;
+    for (uint8_t i = 7; i >= 4; i--) {
+      name[i] = '0' + n % 10;
+      n /= 10;
+    }
+    if (not sFile.open(&sRoot, name, O_READ)) {
+      break;
+    }
+    sFile.close();
+  }
+  uint32_t lastBlock;
+  if (sFileNumber == MAX_FILES || not sFile.createContiguous(&sRoot, name, JOURNAL_BLOCKS * BLOCK_SIZE) ||
+      not sFile.contiguousRange(&sFirstBlock, &lastBlock)) {
+    return false;
+  }
+  sFile.close();
+  sRoot.close();
+  if (not sCard.erase(sFirstBlock, sFirstBlock + JOURNAL_ERASE_BLOCKS - 1)) {
+    return false;
+  }
+  sErased = JOURNAL_ERASE_BLOCKS;
+  sBlock = SdVolume::cacheClear();
+  sBlockNumber = 0;
+  sSpillLength = 0;
+  sDropped = 0;
+  sSyncRequested = false;
+  sSyncTime = millis();
+  startBlock();
+  sReady = true;
+  return true;
+}
+
+/***
+ * Find room for a record of size bytes after the kind and the time
+ * and fill those in. Once a record will not fit in the block, it and
+ * the ones after it go in the spill area until the block is written.
+ */
+static uint8_t *record(uint8_t kind, uint32_t ticks, uint8_t size) {
+  if (not sReady) {
+    return nullptr;
+  }
+  uint8_t length = 1 + 4 + size;
+  uint8_t *p;
+  if (not sFull && sLength + length <= BLOCK_SIZE) {
+    p = sBlock + sLength;
+    sLength += length;
+  } else if (sSpillLength + length <= SPILL_SIZE) {
+    sFull = true;
+    p = sSpill + sSpillLength;
+    sSpillLength += length;
+  } else {
+    if (sDropped < UINT16_MAX) {
+      sDropped++;
+    }
+    return nullptr;
+  }
+  *p++ = kind;
+  return putLittle(p, ticks, 4);
+}
+
+void journalRadio(char c, uint32_t ticks) {
+  uint8_t *p = record(JOURNAL_RADIO, ticks, 1);
+  if (p) {
+    *p = c;
+  }
+}
+
+void journalEvent(char gate, uint8_t confidence, uint32_t ticks) {
+  uint8_t *p = record(JOURNAL_EVENT, ticks, 2);
+  if (p) {
+    *p++ = gate;
+    *p = confidence;
+  }
+}
+
+void journalState(uint8_t state) {
+  uint8_t *p = record(JOURNAL_STATE, timestamp(), 1);
+  if (p) {
+    *p = state;
+  }
+}
+
+void journalMessage(uint8_t type, uint32_t value) {
+  uint8_t *p = record(JOURNAL_MESSAGE, timestamp(), 5);
+  if (p) {
+    *p++ = type;
+    putLittle(p, value, 4);
+  }
+}
+
+// write what there is on the next update, even if the block is not full
+void journalSync() {
+  sSyncRequested = true;
+}
+
+// erase the next JOURNAL_ERASE_BLOCKS of the run, waits for the card
+static bool eraseAhead() {
+  uint32_t end = sErased + JOURNAL_ERASE_BLOCKS;
+  if (end > JOURNAL_BLOCKS) {
+    end = JOURNAL_BLOCKS;
+  }
+  if (not sCard.erase(sFirstBlock + sErased, sFirstBlock + end - 1)) {
+    return false;
+  }
+  sErased = end;
+  return true;
+}
+
+/***
+ * Call once per loop. Writes the block if it is full, or if it holds
+ * something new and a sync is due, and the card is ready for it.
+ * Never waits for a write to finish. Otherwise erases ahead if the
+ * writes are getting near the end of the erased part, which does wait.
+ */
+void journalUpdate() {
+  if (not sReady) {
+    return;
+  }
+  uint32_t start = timestamp();
+  bool due = sLength > sWritten && (sSyncRequested || millis() - sSyncTime >= JOURNAL_SYNC_INTERVAL);
+  bool eraseDue = sErased < JOURNAL_BLOCKS && sErased - sBlockNumber <= JOURNAL_ERASE_BLOCKS / 2;
+  if (not(sFull || due || eraseDue) || sCard.isBusy()) {
+    return;
+  }
+  // the block after this one must be erased before this one is written
+  if (eraseDue && (not(sFull || due) || sBlockNumber + 1 >= sErased)) {
+    if (not eraseAhead()) {
+      sReady = false;  // the card has gone
+      return;
+    }
+  } else {
+    if (not sCard.writeBlock(sFirstBlock + sBlockNumber, sBlock, false)) {
+      sReady = false;  // the card has gone
+      return;
+    }
+    sSyncRequested = false;
+    sSyncTime = millis();
+    sWritten = sLength;
+    if (sFull) {
+      if (++sBlockNumber >= JOURNAL_BLOCKS) {
+        sReady = false;  // the journal is full
+        return;
+      }
+      startBlock();
+    }
+  }
+  uint16_t elapsed = (timestamp() - start) / TIMESTAMP_TICKS_PER_US;
+  if (elapsed > sWorstUpdate) {
+    sWorstUpdate = elapsed;
+  }
+}
+
+bool journalReady() {
+  return sReady;
+}
+
+uint16_t journalDropped() {
+  return sDropped;
+}
+
+uint16_t journalWorstUpdate() {
+  return sWorstUpdate;
+}
@@ -0,0 +1,87 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+
+/***
+ * Event journal on the SD card.
+ *
+ * Everything the controller hears and says is recorded: every radio
+ * character, every decoded gate event, every state change and every
+ * message to the host. Records are a few bytes each and go into a
+ * 512 byte block buffer. journalUpdate() writes the buffer straight
+ * to the card with Sd2Card::writeBlock(). No file system code runs
+ * after journalInit().
+ *
+ * journalInit() makes a new file, JRNLnnnn.BIN, with JOURNAL_BLOCKS
+ * blocks preallocated in one contiguous run. Block n of the journal
+ * is then always the first block of the run plus n, so a block write
+ * never touches the FAT or the directory. The block buffer is the
+ * SdVolume cache, which nothing else uses once the file exists. That
+ * saves another 512 bytes of RAM.
+ *
+ * journalUpdate() is called once per loop and does at most one block
+ * write. It does not wait for the card. If the card is still busy
+ * with the last write, it tries again on the next pass. A write
+ * costs about a millisecond to move 512 bytes over SPI. The longest
+ * update is kept in journalWorstUpdate(), in microseconds. The host
+ * gets it and journalDropped() with the diagnostics.
+ *
+ * The run is erased ahead of the writes so that blocks left on the
+ * card by a deleted journal with the same number cannot pass for part
+ * of this one. Erasing all 16MB in journalInit() could hold up setup()
+ * for as long as the card likes, so only the first JOURNAL_ERASE_BLOCKS
+ * are erased there. journalUpdate() erases the next JOURNAL_ERASE_BLOCKS
+ * once the writes are within half that of the end of the erased part,
+ * on a pass with no block to write. The block after the one being
+ * written is always erased first. An erase waits for the card, so it
+ * shows in journalWorstUpdate().
+ *
+ * A full block is written at once. A part full block is also written
+ * when journalSync() has been called, such as at the end of a run,
+ * and at least every JOURNAL_SYNC_INTERVAL while it holds anything
+ * new. The same block is written again as it fills. After a power
+ * cut, only records that were added since the last write are lost,
+ * never more than one block. If the buffer is full while the card is
+ * busy, new records are dropped and counted in journalDropped().
+ *
+ * Block layout, little endian. Each block starts with a header record
+ * and the rest of the block after the last record is zero.
+ *
+ *   header  'J' 'L', file number (2), block number (4), timestamp()
+ *           ticks (4), corrected microseconds (6), wall clock as
+ *           year - 2000, month, day, hour, minute, second (6)
+ *
+ * Every other record is a kind byte, the timestamp() ticks at which it
+ * happened (4) and then:
+ *
+ *   JOURNAL_RADIO    the character (1) - ticks is the end of its stop bit
+ *   JOURNAL_EVENT    gate character (1), confidence (1) - ticks is
+ *                    the event time worked out from the packet
+ *   JOURNAL_STATE    the new contest state (1)
+ *   JOURNAL_MESSAGE  type (1), value (4), sent to the host
+ *
+ * Ticks are the raw half microsecond timestamp clock. The header
+ * gives the same moment on the corrected clock so ticks can be
+ * unwrapped and corrected. A block whose header does not carry the
+ * right file and block number is past the end of the journal.
+ */
+
+const uint32_t JOURNAL_BLOCKS = 32768;           // 16MB
+const uint16_t JOURNAL_SYNC_INTERVAL = 1000;    // milliseconds
+const uint16_t JOURNAL_ERASE_BLOCKS = 256;       // 128KB
+
+enum JournalKind { JOURNAL_END = 0, JOURNAL_HEADER = 'J', JOURNAL_RADIO = 1, JOURNAL_EVENT, JOURNAL_STATE, JOURNAL_MESSAGE };
+
+bool journalInit(uint8_t chipSelect);
+void journalRadio(char c, uint32_t ticks);
+void journalEvent(char gate, uint8_t confidence, uint32_t ticks);
+void journalState(uint8_t state);
+void journalMessage(uint8_t type, uint32_t value);
+void journalSync();
+void journalUpdate();
+bool journalReady();
+uint16_t journalDropped();
+uint16_t journalWorstUpdate();
+
+#endif
@@ -0,0 +1,112 @@
+#include "lcd.h"
+
+const uint8_t LCD_RS = _BV(0);
+const uint8_t LCD_EN = _BV(2);
+const uint8_t LCD_BACKLIGHT = _BV(3);
+
+const uint8_t LCD_CLEAR = 0x01;
+const uint8_t LCD_ENTRY_INCREMENT = 0x06;
+const uint8_t LCD_DISPLAY_ON = 0x0C;
+const uint8_t LCD_FUNCTION_4BIT_2LINE = 0x28;
+const uint8_t LCD_SET_CGRAM = 0x40;
+const uint8_t LCD_SET_DDRAM = 0x80;
+
+// the four lines do not follow on from one another in DDRAM
+const uint8_t ROW_ADDRESS[] = {0x00, 0x40, 0x14, 0x54};
+
+I2cLcd::I2cLcd(uint8_t address) {
+  mTransfer.address = address;
+  mTransfer.txData = mBuffer;
+  mTransfer.txLength = 0;
+  mTransfer.rxData = nullptr;
+  mTransfer.rxLength = 0;
+  mTransfer.callback = nullptr;
+  mTransfer.status = TWI_OK;
+}
+
+uint8_t *I2cLcd::encode(uint8_t *p, uint8_t value, bool data) {
+  uint8_t flags = LCD_BACKLIGHT | (data ? LCD_RS : 0);
+  uint8_t high = (value & 0xF0) | flags;
+  uint8_t low = (value << 4) | flags;
+  *p++ = high | LCD_EN;
+  *p++ = high;
+  *p++ = low | LCD_EN;
+  *p++ = low;
+  return p;
+}
+
+void I2cLcd::sendNibble(uint8_t nibble) {
+  twiWait(&mTransfer);
+  mBuffer[0] = (nibble << 4) | LCD_BACKLIGHT | LCD_EN;
+  mBuffer[1] = (nibble << 4) | LCD_BACKLIGHT;
+  mTransfer.txLength = 2;
+  twiPost(&mTransfer);
+  twiWait(&mTransfer);
+}
+
+void I2cLcd::send(uint8_t value, bool data) {
+  twiWait(&mTransfer);
+  mTransfer.txLength = encode(mBuffer, value, data) - mBuffer;
+  twiPost(&mTransfer);
+  twiWait(&mTransfer);
+}
+
+/***
+ * The usual initialisation by instruction, from the HD44780 data
+ * sheet, to get into 4 bit mode whatever state the LCD was left in.
+ * Returns false if the backpack does not answer.
+ */
+bool I2cLcd::begin() {
+  delay(50);
+  mBuffer[0] = LCD_BACKLIGHT;
+  mTransfer.txLength = 1;
+  twiPost(&mTransfer);
+  if (twiWait(&mTransfer) != TWI_OK) {
+    return false;
+  }
+  sendNibble(0x3);
+  delayMicroseconds(4500);
+  sendNibble(0x3);
+  delayMicroseconds(4500);
+  sendNibble(0x3);
+  delayMicroseconds(150);
+  sendNibble(0x2);
+  send(LCD_FUNCTION_4BIT_2LINE, false);
+  send(LCD_DISPLAY_ON, false);
+  send(LCD_CLEAR, false);
+  delay(2);
+  send(LCD_ENTRY_INCREMENT, false);
+  return true;
+}
+
+void I2cLcd::createChar(uint8_t location, const char *charmap) {
+  send(LCD_SET_CGRAM | ((location & 0x07) << 3), false);
+  for (uint8_t i = 0; i < 8; i++) {
+    send(pgm_read_byte(charmap + i), true);
+  }
+}
+
+bool I2cLcd::failed() {
+  if (mTransfer.status == TWI_OK || mTransfer.status == TWI_PENDING) {
+    return false;
+  }
+  mTransfer.status = TWI_OK;
+  return true;
+}
+
+void I2cLcd::writeRun(uint8_t column, uint8_t row, const char *chars, uint8_t count) {
+  if (busy()) {
+    return;
+  }
+  if (count > LCD_MAX_RUN) {
+    count = LCD_MAX_RUN;
+  }
+  uint8_t *p = encode(mBuffer, LCD_SET_DDRAM | (ROW_ADDRESS[row & 3] + column), false);
+  while (count--) {
+    p = encode(p, *chars++, true);
+  }
+  mTransfer.txLength = p - mBuffer;
+  if (not twiPost(&mTransfer)) {
+    mTransfer.status = TWI_BUS_ERROR;  // so that failed() reports it
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include <Arduino.h>
+#include "twi.h"
+
+/***
+ * HD44780 20x4 character LCD on a PCF8574 I2C backpack.
+ *
+ * This takes the place of LiquidCrystal_I2C, which could only work
+ * through the blocking Wire library. The backpack wiring is the same:
+ *
+ *   P0 RS   P1 RW   P2 EN   P3 backlight   P4-P7 D4-D7
+ *
+ * The LCD runs in 4 bit mode. Each nibble is two expander writes, one
+ * with EN high and one with it low, and the LCD latches on the falling
+ * edge. At 100kHz one expander byte takes 90us so a whole character
+ * takes 360us and the LCD has always finished the last one, which needs
+ * 37us, before the next arrives. A run of characters can therefore go
+ * in a single I2C write with no delays.
+ *
+ * A run of LCD_MAX_RUN characters and the address holds the bus for
+ * about 1.9ms. The RTC reads that time the clock discipline have to
+ * wait behind it, so runs are kept short.
+ *
+ * begin() and createChar() wait for the bus and are for setup() only.
+ * writeRun() sets the address and sends up to LCD_MAX_RUN characters
+ * in the background. Check busy() before calling it again. failed()
+ * reports, once, that a transfer was not acknowledged.
+ */
+
+const uint8_t LCD_MAX_RUN = 4;
+
+class I2cLcd {
+ public:
+  explicit I2cLcd(uint8_t address);
+
+  bool begin();
+  void createChar(uint8_t location, const char *charmap);  // charmap in PROGMEM
+  bool busy() const { return mTransfer.status == TWI_PENDING; };
+  bool failed();
+  void writeRun(uint8_t column, uint8_t row, const char *chars, uint8_t count);
+
+ private:
+  uint8_t *encode(uint8_t *p, uint8_t value, bool data);
+  void sendNibble(uint8_t nibble);
+  void send(uint8_t value, bool data);
+
+  TwiTransaction mTransfer;
+  uint8_t mBuffer[4 * (LCD_MAX_RUN + 1)];
+};
+
+#endif
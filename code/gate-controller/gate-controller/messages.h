@@ -1,4 +1,6 @@
 #include <Arduino.h>
+#include "hostlink.h"
+#include "journal.h"
 
 // clang-format off
 /***
@@ -8,6 +10,7 @@ Arduino and Visual Basic: Test code for mouse timing system
 Timing performed by Arduino and data passed to VisualBasic PC software
 Overall supervision performed by VisualBasic and passed to the Arduino
 Messages in the format <message_type,value>CrLf
+Messages are queued and sent by hostUpdate(), as text or as binary frames - see hostlink.h
 Implemented message types:
    ENCODED  MESSAGE TYPE      DIRECTION      TX FREQENCY     COMMENTS
    0        MSG_Watchdog      Arduino to PC  1000 msec       Sent every second with an incrementing value to check connection is active
@@ -23,13 +26,28 @@ Implemented message types:
    12       MSG_C1SplitTime   Arduino to PC  Event Driven    Time in milliseconds for the current mouse on its current run 
                                                              (only sent as zero to start host counter)
    13       MSG_C1RunTime     Arduino to PC  Event Driven    Time in milliseconds for a run that has just completed 
-                                                             (definitive time used to calculate score time - sent twice)
+                                                             (definitive time used to calculate score time - repeated until acknowledged)
    30       MSG_CourseTimeMs  Arduino to PC  Event Driven    Time in milliseconds that the current mouse has been active 
                                                              in the maze (only sent as zero to reset host counter)
 
+   60       MSG_ClockPpm      Arduino to PC  64 sec          Controller clock error measured against the RTC in ppm (signed, positive is fast)
+   61       MSG_GatePpm       Arduino to PC  Event Driven    Character clock error of a gate in ppm (signed), followed by the gate character.
+                                                             Sent with each new event from the gate
+   62       MSG_HostWorstSend Arduino to PC  Diagnostic      Longest time taken to queue a message to the PC, in microseconds
+   63       MSG_HostDropped   Arduino to PC  Diagnostic      Messages to the PC dropped because the queue was full
+   64       MSG_HostLost      Arduino to PC  Diagnostic      Run times given up after HOST_TRIES sends with no acknowledgement,
+                                                             or with HOST_PENDING already waiting to go
+   65       MSG_RxOverruns    Arduino to PC  Diagnostic      Radio characters dropped because the receive queue was full
+   66       MSG_RxFraming     Arduino to PC  Diagnostic      Radio characters thrown away for a bad stop bit
+   67       MSG_ScreenWorst   Arduino to PC  Diagnostic      Longest time the loop spent in one screen update, in microseconds
+   68       MSG_ScreenOver    Arduino to PC  Diagnostic      Screen updates that took longer than SCREEN_BUDGET
+   69       MSG_JournalWorst  Arduino to PC  Diagnostic      Longest time the loop spent in one journal update, in microseconds
+   70       MSG_JournalDrops  Arduino to PC  Diagnostic      Journal records dropped because the SD card was busy
+
    71       MSG_STrigger      Arduino to PC  Event Driven    New value of Start Gate trigger (Valid values: 1, 0)
    72       MSG_FTrigger      Arduino to PC  Event Driven    New value of Finish Gate trigger (Valid values: 1, 0)
    73       MSG_CTrigger      Arduino to PC  Event Driven    New value of Mouse in Start Cell trigger (Valid values: 1,0)
+   74       MSG_SystickWorst  Arduino to PC  Diagnostic      Longest time spent in the 2ms systick interrupt, in microseconds
 
    81       MSG_SGLevel       Arduino to PC  100 msec        Intensity level being received by Start Gate phototransistor
    82       MSG_SGPot         Arduino to PC  100 msec        Value read from Start Gate potentiometer
@@ -38,13 +56,22 @@ Implemented message types:
    85       MSG_SCLevel       Arduino to PC  100 msec        Intensity level being received by Mouse in Start Cell phototransistor
    86       MSG_SCPot         Arduino to PC  100 msec        Value read from Mouse in Start Cell potentiometer
 
+   90       MSG_BadCommand    Arduino to PC  Event Driven    A command from the PC was malformed, of an unknown type or had a bad value
+                                                             (value is the number of bad commands so far)
+
 
    98       MSG_NewMouse      PC to Arduino  Event Driven    A new mouse has been selected in the host application 
                                                              (value argument will always be passed as 0)
+                                                             A '>' on its own, as older host software sends, does the same
    99       MSG_SetMode       PC to Arduino  Event Driven    Controls the Arduino mode 
                                                              Valid values: 
                                                                   TIMER       (normal timing mode), 
                                                                   CALIBRATION (start returning calibration data)
+   Commands are decoded by commandParse() - see command.h
+
+   Diagnostic messages go one at a time, straight after each watchdog, so each
+   one is sent every few seconds. The counts stop at 255, except
+   MSG_JournalDrops which stops at 65535.
 
 ***/
 
@@ -67,6 +94,21 @@ const int MSG_STrigger       = 71;
 const int MSG_FTrigger       = 72;
 const int MSG_CTrigger       = 73;
 
+const int MSG_BadCommand     = 90;
+
+const int MSG_ClockPpm       = 60;
+const int MSG_GatePpm        = 61;
+const int MSG_HostWorstSend  = 62;
+const int MSG_HostDropped    = 63;
+const int MSG_HostLost       = 64;
+const int MSG_RxOverruns     = 65;
+const int MSG_RxFraming      = 66;
+const int MSG_ScreenWorst    = 67;
+const int MSG_ScreenOver     = 68;
+const int MSG_JournalWorst   = 69;
+const int MSG_JournalDrops   = 70;
+const int MSG_SystickWorst   = 74;
+
 
 const int MSG_Watchdog       = 0;
 
@@ -74,25 +116,30 @@ extern char last_char;
 // clang-format on
 
 inline void send_message(int type, unsigned long value, const __FlashStringHelper *comment = nullptr) {
-  Serial.print('<');
-  Serial.print(type);
-  Serial.print(',');
-  Serial.print(value);
-  Serial.print('>');
+  char extra = 0;
   if (type == MSG_CURRENT_STATE) {
-    Serial.print(' ');
-    Serial.print(last_char);
+    extra = last_char;
     last_char = '#';
   }
-  Serial.print(comment);
-  Serial.println();
+  journalMessage(type, value);
+  hostSend(type, value, comment, extra);
+}
+
+inline void send_signed_message(int type, long value, const __FlashStringHelper *comment = nullptr, char extra = 0) {
+  journalMessage(type, value);
+  hostSendSigned(type, value, comment, extra);
 }
 
+/***
+ * Sent until the host acknowledges it, rather than twice in the hope
+ * that one arrives. If the window is full it waits in hostlink until
+ * there is room, so the only way it fails to go is to be counted in
+ * hostLost().
+ */
 void send_run_time(unsigned long time) {
-  // TODO Why do we need to send the time twice?
-  send_message(MSG_C1RunTime, time, F(" RUN TIME"));
-  delay(20);
-  send_message(MSG_C1RunTime, time, F(" RUN TIME"));
+  journalMessage(MSG_C1RunTime, time);
+  journalSync();
+  hostSendReliable(MSG_C1RunTime, time, F(" RUN TIME"));
 }
 
 void send_maze_time(unsigned long time) {
@@ -0,0 +1,161 @@
+#include "receiver.h"
+#include "pins.h"
+#include "timestamp.h"
+
+// the analog comparator input is fixed in hardware
+static_assert(RADIO_RX == 7, "RADIO_RX must be AIN1 (D7) for edge capture");
+
+const uint8_t STOP_BIT = 9;
+const uint16_t FRAME_END = STOP_BIT * RX_BIT_TICKS + RX_BIT_TICKS / 2;
+const uint8_t RX_QUEUE_MASK = RX_QUEUE_SIZE - 1;
+static_assert((RX_QUEUE_SIZE & RX_QUEUE_MASK) == 0, "queue size must be a power of two");
+
+static volatile char sQueue[RX_QUEUE_SIZE];
+static volatile uint32_t sTimes[RX_QUEUE_SIZE];
+static volatile uint8_t sHead;  // written only by the ISRs
+static volatile uint8_t sTail;  // written only by the loop
+static volatile uint8_t sOverruns;
+static volatile uint8_t sFramingErrors;
+
+static bool sInFrame;
+static uint16_t sStartEdge;  // capture count at the start of the frame
+static uint8_t sBit;         // the bit at which the current level began
+static bool sLevel;          // the line level since the last edge
+static uint8_t sData;
+
+// The comparator output is high while the line is below the bandgap
+// reference so it is the inverse of the line.
+static inline bool lineLevel() {
+  return bit_is_clear(ACSR, ACO);
+}
+
+// Capture the next change of the line, whichever way it goes. ICF1
+// must be cleared after the edge select has been changed.
+static inline void captureNextEdge(bool level) {
+  if (level) {
+    bitSet(TCCR1B, ICES1);  // line falls, comparator rises
+  } else {
+    bitClear(TCCR1B, ICES1);
+  }
+  bitSet(TIFR1, ICF1);
+}
+
+// record bits up to, but not including, bit end at the current level
+static inline void fillBits(uint8_t end) {
+  if (end > STOP_BIT) {
+    end = STOP_BIT;
+  }
+  for (uint8_t i = sBit; i < end; i++) {
+    if (sLevel && i > 0) {
+      sData |= 1 << (i - 1);
+    }
+  }
+  sBit = end;
+}
+
+void rxInit() {
+  pinMode(RADIO_RX, INPUT);
+  bitSet(DIDR1, AIN1D);  // no digital input buffer on AIN1
+  bitClear(ADCSRB, ACME);
+  // bandgap on the positive input, AIN1 on the negative, output to Timer 1 capture
+  ACSR = _BV(ACBG) | _BV(ACIC);
+  sHead = 0;
+  sTail = 0;
+  sOverruns = 0;
+  sFramingErrors = 0;
+  sInFrame = false;
+  bitClear(TIMSK1, OCIE1A);
+  bitSet(TCCR1B, ICNC1);  // 4 clock noise canceller, a fixed 0.25us delay
+  // the bandgap takes a while to settle
+  delayMicroseconds(100);
+  captureNextEdge(lineLevel());
+  bitSet(TIMSK1, ICIE1);
+}
+
+/***
+ * Get the next character and the timestamp() at which its stop bit
+ * ended. Returns false if there is nothing to read.
+ */
+bool rxRead(char &c, uint32_t &time) {
+  uint8_t tail = sTail;
+  if (tail == sHead) {
+    return false;
+  }
+  c = sQueue[tail & RX_QUEUE_MASK];
+  time = sTimes[tail & RX_QUEUE_MASK];
+  sTail = tail + 1;
+  return true;
+}
+
+void rxFlush() {
+  sTail = sHead;
+}
+
+uint8_t rxOverruns() {
+  return sOverruns;
+}
+
+uint8_t rxFramingErrors() {
+  return sFramingErrors;
+}
+
+/***
+ * Runs on every change of the line. The capture unit has already
+ * latched the time of the edge so it does not matter how late this
+ * runs, as long as it is before the next edge.
+ *
+ * Inside a frame, the time since the start edge says which bit the
+ * new level starts at and every bit since the last edge had the old
+ * level. The line level is read from the comparator rather than
+ * assumed to alternate so a missed glitch cannot invert the rest of
+ * the frame. A start bit that ends within half a bit is ignored.
+ */
+ISR(TIMER1_CAPT_vect) {
+  uint16_t edge = ICR1;
+  bool level = lineLevel();
+  captureNextEdge(level);
+  if (sInFrame) {
+    uint8_t bit = (uint16_t)(edge - sStartEdge + RX_BIT_TICKS / 2) / RX_BIT_TICKS;
+    if (bit == 0) {
+      // less than half a start bit - just a glitch
+      bitClear(TIMSK1, OCIE1A);
+      sInFrame = false;
+      return;
+    }
+    fillBits(bit);
+    sLevel = level;
+    return;
+  }
+  if (level) {
+    return;  // the line went high between frames
+  }
+  sInFrame = true;
+  sStartEdge = edge;
+  sBit = 0;
+  sLevel = false;
+  sData = 0;
+  // there may not be another edge in this frame so finish it half way through the stop bit
+  OCR1A = edge + FRAME_END;
+  bitSet(TIFR1, OCF1A);
+  bitSet(TIMSK1, OCIE1A);
+}
+
+ISR(TIMER1_COMPA_vect) {
+  bitClear(TIMSK1, OCIE1A);
+  sInFrame = false;
+  fillBits(STOP_BIT);
+  if (not lineLevel()) {
+    if (sFramingErrors < UINT8_MAX) {
+      sFramingErrors++;
+    }
+    return;
+  }
+  uint8_t head = sHead;
+  if ((uint8_t)(head - sTail) < RX_QUEUE_SIZE) {
+    sQueue[head & RX_QUEUE_MASK] = sData;
+    sTimes[head & RX_QUEUE_MASK] = timestampAt(sStartEdge) + RX_CHAR_TICKS;
+    sHead = head + 1;
+  } else if (sOverruns < UINT8_MAX) {
+    sOverruns++;
+  }
+}
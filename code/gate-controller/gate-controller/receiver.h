@@ -0,0 +1,56 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <Arduino.h>
+#include "timestamp.h"
+
+/***
+ * Interrupt driven radio receiver.
+ *
+ * This replaces SoftwareSerial for the radio. Characters are 10 bit
+ * frames at 5000 baud from the gate transmitters.
+ *
+ * RADIO_RX is D7 which is also AIN1, the negative input of the analog
+ * comparator. The comparator compares it with the 1.1V bandgap and
+ * its output drives the input capture unit of Timer 1. Every change
+ * of the line latches the timer count in hardware, to 0.5us, no
+ * matter what else is running. The capture interrupt then selects the
+ * opposite edge for the next capture.
+ *
+ * Bytes are decoded from the edge times. The time from the start edge
+ * to each later edge says which bit the new level starts at. There
+ * may be no edge at all after the last data bits so the compare A
+ * interrupt finishes the frame half way through the stop bit. The
+ * character goes into a queue along with the time at which its stop
+ * bit ended, worked out from the captured start edge. Nothing waits
+ * and interrupts are never disabled for more than a few instructions
+ * so the systick keeps running normally.
+ *
+ * The timestamp does not depend on when the loop gets round to reading
+ * the character so a slow LCD update or a delay() cannot shift an
+ * event time. Timestamps are on the timestamp() clock in half
+ * microsecond ticks.
+ *
+ * If the loop falls so far behind that the queue fills, further
+ * characters are dropped and counted in rxOverruns(), which the host
+ * gets as MSG_RxOverruns. The queue holds RX_QUEUE_SIZE characters,
+ * 64ms worth. Frames with a bad stop bit
+ * are counted in rxFramingErrors(), sent as MSG_RxFraming.
+ *
+ * timestampInit() must be called before rxInit().
+ */
+
+const uint16_t RX_BAUD = 5000;
+const uint16_t RX_BIT_TIME = 1000000UL / RX_BAUD;  // microseconds
+const uint16_t RX_CHAR_TIME = 10 * RX_BIT_TIME;
+const uint16_t RX_BIT_TICKS = TIMESTAMP_TICKS_PER_US * RX_BIT_TIME;
+const uint16_t RX_CHAR_TICKS = TIMESTAMP_TICKS_PER_US * RX_CHAR_TIME;
+const uint8_t RX_QUEUE_SIZE = 32;
+
+void rxInit();
+bool rxRead(char &c, uint32_t &time);
+void rxFlush();
+uint8_t rxOverruns();
+uint8_t rxFramingErrors();
+
+#endif
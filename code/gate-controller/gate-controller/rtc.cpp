@@ -0,0 +1,103 @@
+#include "rtc.h"
+#include "timestamp.h"
+#include "twi.h"
+
+const uint8_t REG_CONTROL_1 = 0x00;
+const uint8_t REG_SECONDS = 0x02;
+const uint8_t TIME_REGISTERS = 7;  // seconds to years
+const uint8_t VL_BIT = 0x80;
+const uint8_t CENTURY_BIT = 0x80;
+
+static const uint8_t sTimeRegister = REG_SECONDS;
+static uint8_t sControl[2] = {REG_CONTROL_1, 0x00};  // clock running, no test modes
+static uint8_t sRegisters[TIME_REGISTERS];
+static TwiTransaction sTransfer;
+static RtcTime sTime;
+static volatile bool sHaveTime;
+
+static uint8_t bcd(uint8_t value) {
+  return (value >> 4) * 10 + (value & 0x0F);
+}
+
+// called from the TWI interrupt
+static void decode(TwiTransaction *t) {
+  if (t->status != TWI_OK) {
+    return;
+  }
+  sTime.ticks = timestamp();
+  sTime.valid = (sRegisters[0] & VL_BIT) == 0;
+  sTime.second = bcd(sRegisters[0] & 0x7F);
+  sTime.minute = bcd(sRegisters[1] & 0x7F);
+  sTime.hour = bcd(sRegisters[2] & 0x3F);
+  sTime.day = bcd(sRegisters[3] & 0x3F);
+  // sRegisters[4] is the day of the week
+  sTime.month = bcd(sRegisters[5] & 0x1F);
+  sTime.year = 2000 + bcd(sRegisters[6]) + ((sRegisters[5] & CENTURY_BIT) ? 100 : 0);
+  sHaveTime = true;
+}
+
+bool rtcInit() {
+  sTransfer.address = RTC_ADDRESS;
+  sTransfer.txData = sControl;
+  sTransfer.txLength = sizeof(sControl);
+  sTransfer.rxData = nullptr;
+  sTransfer.rxLength = 0;
+  sTransfer.callback = nullptr;
+  twiPost(&sTransfer);
+  if (twiWait(&sTransfer) != TWI_OK) {
+    return false;
+  }
+  rtcRequest();
+  return twiWait(&sTransfer) == TWI_OK;
+}
+
+/***
+ * Returns false if the last request has not finished yet.
+ */
+bool rtcRequest() {
+  if (sTransfer.status == TWI_PENDING) {
+    return false;
+  }
+  sTransfer.address = RTC_ADDRESS;
+  sTransfer.txData = &sTimeRegister;
+  sTransfer.txLength = 1;
+  sTransfer.rxData = sRegisters;
+  sTransfer.rxLength = TIME_REGISTERS;
+  sTransfer.callback = decode;
+  return twiPost(&sTransfer);
+}
+
+bool rtcNow(RtcTime &time) {
+  uint8_t oldSREG = SREG;
+  cli();
+  bool have = sHaveTime;
+  time = sTime;
+  SREG = oldSREG;
+  return have;
+}
+
+static char *putTwo(char *p, uint8_t value) {
+  *p++ = '0' + value / 10;
+  *p++ = '0' + value % 10;
+  return p;
+}
+
+// DD.MM.YYYY  hh:mm:ss - the buffer must hold 21 characters
+char *rtcFormat(char *buffer, const RtcTime &time) {
+  char *p = buffer;
+  p = putTwo(p, time.day);
+  *p++ = '.';
+  p = putTwo(p, time.month);
+  *p++ = '.';
+  p = putTwo(p, time.year / 100);
+  p = putTwo(p, time.year % 100);
+  *p++ = ' ';
+  *p++ = ' ';
+  p = putTwo(p, time.hour);
+  *p++ = ':';
+  p = putTwo(p, time.minute);
+  *p++ = ':';
+  p = putTwo(p, time.second);
+  *p = 0;
+  return buffer;
+}
@@ -0,0 +1,43 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include <Arduino.h>
+
+/***
+ * PCF8563 real time clock on the interrupt driven I2C bus.
+ *
+ * This takes the place of RTClib, which needed Wire. rtcRequest()
+ * posts a read of the seven time registers and returns at once. The
+ * TWI interrupt decodes the reply when it arrives, about 1ms later,
+ * and rtcNow() then gives the latest time read. The loop never waits
+ * for the clock.
+ *
+ * Each reading carries the timestamp() at which the reply arrived so
+ * the controller clock can be measured against the RTC. A new reading
+ * always has a new time.
+ *
+ * The VL bit in the seconds register is set if the clock lost power
+ * and the time cannot be trusted. That is reported as valid = false.
+ *
+ * rtcInit() waits for the bus and is for setup() only.
+ */
+
+const uint8_t RTC_ADDRESS = 0x51;
+
+struct RtcTime {
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  bool valid;
+  uint32_t ticks;  // timestamp() when the reply arrived
+};
+
+bool rtcInit();
+bool rtcRequest();
+bool rtcNow(RtcTime &time);
+char *rtcFormat(char *buffer, const RtcTime &time);
+
+#endif
@@ -0,0 +1,108 @@
+#include "screen.h"
+
+Screen::Screen(I2cLcd &lcd) : mLcd(lcd) {
+  memset(mShadow, ' ', CELLS);
+  memset(mDirty, 0, sizeof(mDirty));
+  mCursor = 0;
+  mScan = 0;
+  mWorstStall = 0;
+  mOverBudget = 0;
+}
+
+// the LCD has just been cleared so start again with nothing dirty
+void Screen::begin() {
+  memset(mShadow, ' ', CELLS);
+  memset(mDirty, 0, sizeof(mDirty));
+  mCursor = 0;
+}
+
+void Screen::clear() {
+  for (uint8_t i = 0; i < CELLS; i++) {
+    if (mShadow[i] != ' ') {
+      mShadow[i] = ' ';
+      mDirty[i / 8] |= 1 << (i % 8);
+    }
+  }
+  mCursor = 0;
+}
+
+void Screen::setCursor(uint8_t column, uint8_t row) {
+  if (column >= COLUMNS || row >= ROWS) {
+    mCursor = NO_CELL;
+    return;
+  }
+  mCursor = row * COLUMNS + column;
+}
+
+size_t Screen::write(uint8_t c) {
+  if (mCursor == NO_CELL) {
+    return 0;
+  }
+  if (mShadow[mCursor] != (char)c) {
+    mShadow[mCursor] = c;
+    mDirty[mCursor / 8] |= 1 << (mCursor % 8);
+  }
+  mCursor++;
+  if (mCursor % COLUMNS == 0) {
+    mCursor = NO_CELL;  // off the end of the line
+  }
+  return 1;
+}
+
+bool Screen::dirty() const {
+  for (uint8_t i = 0; i < sizeof(mDirty); i++) {
+    if (mDirty[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/***
+ * Returns true when the panel matches the shadow.
+ */
+bool Screen::update() {
+  uint32_t start = micros();
+  if (mLcd.failed()) {
+    memset(mDirty, 0xFF, sizeof(mDirty));
+  }
+  if (mLcd.busy()) {
+    return false;
+  }
+  uint8_t first = NO_CELL;
+  for (uint8_t n = 0; n < CELLS; n++) {
+    uint8_t cell = mScan;
+    if (++mScan == CELLS) {
+      mScan = 0;
+    }
+    if (isDirty(cell)) {
+      first = cell;
+      break;
+    }
+  }
+  if (first == NO_CELL) {
+    return true;
+  }
+  uint8_t count = 0;
+  uint8_t cell = first;
+  do {
+    mDirty[cell / 8] &= ~(1 << (cell % 8));
+    cell++;
+    count++;
+  } while (count < LCD_MAX_RUN && cell % COLUMNS != 0 && isDirty(cell));
+  mScan = cell % CELLS;
+  mLcd.writeRun(first % COLUMNS, first / COLUMNS, mShadow + first, count);
+  uint16_t elapsed = micros() - start;
+  if (elapsed > mWorstStall) {
+    mWorstStall = elapsed;
+  }
+  if (elapsed > SCREEN_BUDGET && mOverBudget < UINT8_MAX) {
+    mOverBudget++;
+  }
+  return false;
+}
+
+void Screen::refresh() {
+  while (not update()) {
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <Arduino.h>
+#include "lcd.h"
+
+/***
+ * Shadow framebuffer for the 20x4 LCD.
+ *
+ * The Screen looks like the LCD to the rest of the code - clear(),
+ * setCursor() and everything in Print - but all it does is write to a
+ * copy of the display in RAM. A character that is different from the
+ * one already there is marked as dirty.
+ *
+ * update() is called once per loop. If the last transfer to the LCD
+ * has finished, it finds the next run of dirty characters on one line,
+ * carrying on from where it stopped last time, and hands up to
+ * LCD_MAX_RUN of them to the LCD to send in the background. The loop
+ * only pays for copying them into the transfer buffer. The longest
+ * time spent in any one update() is kept in worstStall() and the
+ * updates that took longer than SCREEN_BUDGET are counted in
+ * overBudget(). The host gets both with the diagnostics. If a
+ * transfer fails, the whole display is sent again.
+ *
+ * refresh() waits until the panel matches the shadow. It is for use
+ * in setup() and other places that already block.
+ *
+ * Writes past the end of a line are dropped. The panel would carry
+ * on into a different line.
+ */
+
+const uint16_t SCREEN_BUDGET = 250;  // microseconds per update()
+
+class Screen : public Print {
+ public:
+  static const uint8_t COLUMNS = 20;
+  static const uint8_t ROWS = 4;
+
+  explicit Screen(I2cLcd &lcd);
+
+  void begin();
+  void clear();
+  void setCursor(uint8_t column, uint8_t row);
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  bool update();
+  void refresh();
+  bool dirty() const;
+  uint16_t worstStall() const { return mWorstStall; };
+  uint8_t overBudget() const { return mOverBudget; };
+
+ private:
+  static const uint8_t CELLS = COLUMNS * ROWS;
+  static const uint8_t NO_CELL = 0xFF;
+
+  bool isDirty(uint8_t cell) const { return mDirty[cell / 8] & (1 << (cell % 8)); };
+
+  I2cLcd &mLcd;
+  char mShadow[CELLS];
+  uint8_t mDirty[CELLS / 8];
+  uint8_t mCursor;  // next cell for write()
+  uint8_t mScan;    // where update() carries on from
+  uint16_t mWorstStall;
+  uint8_t mOverBudget;
+};
+
+#endif
@@ -1,5 +0,0 @@
-#include <Arduino.h>
-#include <SD.h>
-
-void sdCardInit(int chipSelectPin, int cardDetectPin) ;
-void cardInfo();
\ No newline at end of file
@@ -7,22 +7,32 @@
 
 #include "stopwatch.h"
 #include <Arduino.h>
-Stopwatch::Stopwatch() : mState(RESET), mTime(0) {
+Stopwatch::Stopwatch(Clock clock) : mClock(clock), mState(RESET) {
   reset();
 }
 
 Stopwatch::~Stopwatch() = default;
 
 
+// does nothing if the watch is already running
 void Stopwatch::start() {
   if (mState != Stopwatch::RUNNING) {
-    mState = Stopwatch::RUNNING;
-    reset();
+    restart();
   }
 };
 
 void Stopwatch::stop() {
+  stop(mClock());
+};
+
+/***
+ * Stop the watch at a time that has already passed. Used when the
+ * time comes from an event like a gate being broken rather than from
+ * the moment the event is processed.
+ */
+void Stopwatch::stop(uint64_t stopMicros) {
   if (mState == Stopwatch::RUNNING) {
+    mStopMicros = stopMicros;
     mState = Stopwatch::STOPPED;
   }
   // reset();
@@ -33,31 +43,43 @@ void Stopwatch::restart() {
   mState = Stopwatch::RUNNING;
 }
 
-uint32_t Stopwatch::time() {
+void Stopwatch::restart(uint64_t startMicros) {
+  reset();
+  mStartMicros = startMicros;
+  mStopMicros = startMicros;
+  mState = Stopwatch::RUNNING;
+}
+
+/***
+ * An event time before the start, which can happen if a button and a
+ * gate disagree, counts as no time at all.
+ */
+uint64_t Stopwatch::elapsedMicros() {
   if (mState == Stopwatch::RUNNING) {
-    mStopMillis = millis();
+    mStopMicros = mClock();
   }
-  mTime = (mStopMillis - mStartMillis) ;
-  return mTime;
+  return (mStopMicros > mStartMicros) ? mStopMicros - mStartMicros : 0;
+}
+
+uint32_t Stopwatch::time() {
+  return elapsedMicros() / 1000;
 }
 
 /**
  *
- * @return lap time in microseconds, reset timer
+ * @return lap time in milliseconds, reset timer
  */
 uint32_t Stopwatch::lap() {
   if (mState == Stopwatch::RUNNING) {
-    mStopMillis = millis();
-    mLapTime = (mStopMillis - mStartMillis) ;
-    mStartMillis = mStopMillis;
+    mLapTime = elapsedMicros() / 1000;
+    mStartMicros = mStopMicros;
   }
   return mLapTime;
 }
 
 uint32_t Stopwatch::split() {
   if (mState == Stopwatch::RUNNING) {
-    mStopMillis = millis();
-    mSplitTime = (mStopMillis - mStartMillis) ;
+    mSplitTime = elapsedMicros() / 1000;
   }
   return mSplitTime;
 }
@@ -65,7 +87,7 @@ uint32_t Stopwatch::split() {
 void Stopwatch::reset() {
   mSplitTime = 0;
   mLapTime = 0;
-  mStartMillis = millis();
-  mStopMillis = mStartMillis;
+  mStartMicros = mClock();
+  mStopMicros = mStartMicros;
   mState = RESET;
 };
@@ -9,28 +9,49 @@
 #define STOPWATCH_H
 
 #include <Arduino.h>
+#include "discipline.h"
+
+/***
+ * The stopwatch keeps its start and stop times as 64 bit microsecond
+ * counts from the Timer 1 timestamp clock, so it has microsecond
+ * resolution and does not wrap. By default the clock is corrected
+ * against the RTC by disciplinedMicros(). time(), lap() and split() still give
+ * milliseconds for the display and the PC. elapsedMicros() gives the
+ * full resolution.
+ *
+ * stop() and restart() can be given the time of an event that has
+ * already happened, such as a decoded radio packet or a button press,
+ * rather than the time they are called.
+ *
+ * The clock is a constructor parameter so that the stopwatch can be
+ * run against a simulated timebase.
+ */
 
 class Stopwatch {
  public:
   enum State { STOPPED, RUNNING, RESET };
-  Stopwatch();
+  typedef uint64_t (*Clock)();
+
+  explicit Stopwatch(Clock clock = disciplinedMicros);
 
   virtual ~Stopwatch();
   void start();
   void stop();
+  void stop(uint64_t stopMicros);
   void restart();
+  void restart(uint64_t startMicros);
   void reset();
   bool running() { return mState == RUNNING; };
+  uint64_t elapsedMicros();
   uint32_t time();
   uint32_t lap();
   uint32_t split();
 
  private:
+  Clock mClock;
   enum State mState;
-  uint32_t cyclesPerMicrosecond;
-  uint32_t mStartMillis;
-  uint32_t mStopMillis;
-  uint32_t mTime;
+  uint64_t mStartMicros;
+  uint64_t mStopMicros;
   uint32_t mLapTime;
   uint32_t mSplitTime;
 };
@@ -0,0 +1,59 @@
+#include "timestamp.h"
+
+static volatile uint32_t sOverflows;
+
+void timestampInit() {
+  // normal mode, count from 0 to 0xFFFF
+  TCCR1A = 0;
+  // divisor = 8 => timer clock = 2MHz
+  TCCR1B = _BV(CS11);
+  TCNT1 = 0;
+  sOverflows = 0;
+  bitSet(TIFR1, TOV1);   // clear any pending overflow
+  bitSet(TIMSK1, TOIE1); // enable the overflow interrupt
+}
+
+ISR(TIMER1_OVF_vect) {
+  sOverflows++;
+}
+
+// read the count and the overflows that go with it
+static uint16_t readCount(uint32_t &overflows) {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t count = TCNT1;
+  overflows = sOverflows;
+  // An overflow may be pending if interrupts were already disabled.
+  // If the count is small, it happened before TCNT1 was read.
+  if (bit_is_set(TIFR1, TOV1) && count < 0x8000) {
+    overflows++;
+  }
+  SREG = oldSREG;
+  return count;
+}
+
+uint32_t timestamp() {
+  uint32_t overflows;
+  uint16_t count = readCount(overflows);
+  return (overflows << 16) | count;
+}
+
+static uint64_t ticks() {
+  uint32_t overflows;
+  uint16_t count = readCount(overflows);
+  return ((uint64_t)overflows << 16) | count;
+}
+
+uint32_t timestampAt(uint16_t count) {
+  uint32_t now = timestamp();
+  return now - (uint16_t)((uint16_t)now - count);
+}
+
+uint64_t timestampMicros() {
+  return ticks() / TIMESTAMP_TICKS_PER_US;
+}
+
+uint64_t timestampMicrosAt(uint32_t ticksAt) {
+  uint64_t now = ticks();
+  return (now - (uint32_t)((uint32_t)now - ticksAt)) / TIMESTAMP_TICKS_PER_US;
+}
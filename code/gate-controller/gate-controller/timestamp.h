@@ -0,0 +1,39 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <Arduino.h>
+
+/***
+ * Free-running half microsecond clock.
+ *
+ * Timer 1 counts at F_CPU/8, which is 2MHz on the 16MHz controller,
+ * and the overflow interrupt extends the count to 32 bits. The count
+ * wraps after about 35 minutes so only differences between timestamps
+ * are meaningful.
+ *
+ * The radio receiver uses the input capture unit of the same timer so
+ * its edge times are on this clock. micros() only has a resolution of
+ * 4us and depends on the Timer 0 interrupt which can be held off.
+ *
+ * timestamp() may be called with interrupts enabled or from inside
+ * an ISR. timestampAt() turns a 16 bit capture or compare value from
+ * the last 32ms into a full timestamp.
+ *
+ * The overflow count is kept to 32 bits so the whole count is 48 bits
+ * and never wraps in practice. timestampMicros() gives it as a 64 bit
+ * number of microseconds since timestampInit(). timestampMicrosAt()
+ * does the same for a timestamp() from the last 35 minutes, such as
+ * the time of a radio packet or a button press.
+ */
+
+static_assert(F_CPU == 16000000L, "the timestamp clock expects a 16MHz processor");
+
+const uint8_t TIMESTAMP_TICKS_PER_US = 2;
+
+void timestampInit();
+uint32_t timestamp();
+uint32_t timestampAt(uint16_t count);
+uint64_t timestampMicros();
+uint64_t timestampMicrosAt(uint32_t ticks);
+
+#endif
@@ -0,0 +1,208 @@
+#include "twi.h"
+#include "pins.h"
+
+const uint8_t TWI_QUEUE_MASK = TWI_QUEUE_SIZE - 1;
+static_assert((TWI_QUEUE_SIZE & TWI_QUEUE_MASK) == 0, "queue size must be a power of two");
+static_assert((F_CPU / TWI_FREQUENCY - 16) / 2 <= 255, "TWI frequency is too low for prescaler 1");
+
+// TWSR status codes for a master
+const uint8_t TW_START = 0x08;
+const uint8_t TW_REP_START = 0x10;
+const uint8_t TW_MT_SLA_ACK = 0x18;
+const uint8_t TW_MT_SLA_NACK = 0x20;
+const uint8_t TW_MT_DATA_ACK = 0x28;
+const uint8_t TW_MT_DATA_NACK = 0x30;
+const uint8_t TW_ARB_LOST = 0x38;
+const uint8_t TW_MR_SLA_ACK = 0x40;
+const uint8_t TW_MR_SLA_NACK = 0x48;
+const uint8_t TW_MR_DATA_ACK = 0x50;
+const uint8_t TW_MR_DATA_NACK = 0x58;
+
+const uint8_t TWCR_RUN = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+
+static TwiTransaction *volatile sQueue[TWI_QUEUE_SIZE];
+static volatile uint8_t sHead;  // written only by twiPost()
+static volatile uint8_t sTail;  // written only by the ISR
+static uint8_t sIndex;          // next byte to send or receive
+static volatile uint32_t sStarted;  // millis() when the current transaction started
+
+static void enable() {
+  // the internal pullups help the ones on the LCD backpack
+  pinMode(I2C_SDA, INPUT);
+  pinMode(I2C_SCL, INPUT);
+  digitalWrite(I2C_SDA, HIGH);
+  digitalWrite(I2C_SCL, HIGH);
+  TWSR = 0;  // prescaler 1
+  TWBR = (F_CPU / TWI_FREQUENCY - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+void twiInit() {
+  enable();
+  sHead = 0;
+  sTail = 0;
+}
+
+static void start() {
+  sStarted = millis();
+  TWCR = TWCR_RUN | _BV(TWSTA);
+}
+
+bool twiPost(TwiTransaction *transaction) {
+  bool posted = false;
+  uint8_t oldSREG = SREG;
+  cli();
+  uint8_t head = sHead;
+  if ((uint8_t)(head - sTail) < TWI_QUEUE_SIZE) {
+    transaction->status = TWI_PENDING;
+    sQueue[head & TWI_QUEUE_MASK] = transaction;
+    sHead = head + 1;
+    if (head == sTail) {
+      // the stop at the end of the last transaction takes a few
+      // microseconds, unless the bus is stuck and twiCheck() sorts it out
+      for (uint8_t n = 0; n < 255 && (TWCR & _BV(TWSTO)); n++) {
+      }
+      sIndex = 0;
+      start();
+    }
+    posted = true;
+  }
+  SREG = oldSREG;
+  return posted;
+}
+
+TwiStatus twiWait(TwiTransaction *transaction) {
+  while (transaction->status == TWI_PENDING) {
+    twiCheck();
+  }
+  return transaction->status;
+}
+
+// open drain by hand, a high is left to the pullups
+static void drive(uint8_t pin, bool high) {
+  if (high) {
+    pinMode(pin, INPUT);
+    digitalWrite(pin, HIGH);
+  } else {
+    digitalWrite(pin, LOW);
+    pinMode(pin, OUTPUT);
+  }
+  delayMicroseconds(5);  // half a clock at 100kHz
+}
+
+/***
+ * Nine clocks are enough for a device that is part way through
+ * sending a byte to finish it and let go of SDA. The stop then puts
+ * every device back to waiting for a start.
+ */
+static void recover() {
+  TWCR = 0;  // hand the pins back to the port
+  for (uint8_t n = 0; n < 9 && digitalRead(I2C_SDA) == LOW; n++) {
+    drive(I2C_SCL, LOW);
+    drive(I2C_SCL, HIGH);
+  }
+  drive(I2C_SCL, LOW);
+  drive(I2C_SDA, LOW);
+  drive(I2C_SCL, HIGH);
+  drive(I2C_SDA, HIGH);
+  enable();
+  while (sTail != sHead) {
+    TwiTransaction *t = sQueue[sTail & TWI_QUEUE_MASK];
+    sTail = sTail + 1;
+    t->status = TWI_TIMEOUT;
+    if (t->callback) {
+      t->callback(t);
+    }
+  }
+}
+
+void twiCheck() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (sHead != sTail && millis() - sStarted > TWI_TIMEOUT_MS) {
+    recover();
+  }
+  SREG = oldSREG;
+}
+
+/***
+ * Send a stop, finish the current transaction and, if there is
+ * another one waiting, ask for a start straight after the stop.
+ */
+static void finish(TwiTransaction *t, TwiStatus status) {
+  uint8_t tail = sTail + 1;
+  sTail = tail;
+  sIndex = 0;
+  if (tail != sHead) {
+    sStarted = millis();
+    TWCR = TWCR_RUN | _BV(TWSTO) | _BV(TWSTA);
+  } else {
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  }
+  t->status = status;
+  if (t->callback) {
+    t->callback(t);
+  }
+}
+
+// ask for the next byte and acknowledge it unless it is the last one
+static void receive(TwiTransaction *t) {
+  if (sIndex + 1 < t->rxLength) {
+    TWCR = TWCR_RUN | _BV(TWEA);
+  } else {
+    TWCR = TWCR_RUN;
+  }
+}
+
+ISR(TWI_vect) {
+  TwiTransaction *t = sQueue[sTail & TWI_QUEUE_MASK];
+  switch (TWSR & 0xF8) {
+    case TW_START:
+      if (t->txLength > 0 || t->rxLength == 0) {
+        TWDR = t->address << 1;
+      } else {
+        TWDR = (t->address << 1) | 1;
+      }
+      TWCR = TWCR_RUN;
+      break;
+    case TW_REP_START:
+      TWDR = (t->address << 1) | 1;
+      TWCR = TWCR_RUN;
+      break;
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (sIndex < t->txLength) {
+        TWDR = t->txData[sIndex++];
+        TWCR = TWCR_RUN;
+      } else if (t->rxLength > 0) {
+        sIndex = 0;
+        start();  // repeated start for the read
+      } else {
+        finish(t, TWI_OK);
+      }
+      break;
+    case TW_MR_SLA_ACK:
+      receive(t);
+      break;
+    case TW_MR_DATA_ACK:
+      t->rxData[sIndex++] = TWDR;
+      receive(t);
+      break;
+    case TW_MR_DATA_NACK:
+      t->rxData[sIndex++] = TWDR;
+      finish(t, TWI_OK);
+      break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      finish(t, TWI_NACK_ADDRESS);
+      break;
+    case TW_MT_DATA_NACK:
+      finish(t, TWI_NACK_DATA);
+      break;
+    case TW_ARB_LOST:
+    default:
+      // there is no other master so this is noise on the bus
+      finish(t, TWI_BUS_ERROR);
+      break;
+  }
+}
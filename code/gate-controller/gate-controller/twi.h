@@ -0,0 +1,57 @@
+#ifndef TWI_H
+#define TWI_H
+
+#include <Arduino.h>
+
+/***
+ * Interrupt driven I2C master.
+ *
+ * This replaces Wire for the LCD expander and the RTC. Wire spins on
+ * the bus for the whole of every transaction and at 100kHz a single
+ * LCD character costs about a millisecond of the main loop.
+ *
+ * A transaction writes txLength bytes and then, after a repeated
+ * start, reads rxLength bytes. Either length may be zero. The caller
+ * owns the TwiTransaction and its buffers and must not touch them
+ * until status is no longer TWI_PENDING. twiPost() puts it on a short
+ * queue and returns at once. The TWI interrupt works through the
+ * queue, one transaction after another, and calls the callback, if
+ * there is one, when each finishes. Callbacks run inside the ISR so
+ * they should only copy data or set flags.
+ *
+ * The bus runs at 100kHz. The PCF8563 could go at 400kHz but the
+ * PCF8574 on the LCD backpack is only rated for 100kHz Standard-mode.
+ *
+ * A device that is reset or glitched part way through a byte can hold
+ * SDA low, and then nothing more happens on the bus. twiCheck() is
+ * called on every pass of the loop. If a transaction has been on the
+ * bus for more than TWI_TIMEOUT_MS it frees the bus by clocking SCL by
+ * hand until SDA is released, sends a stop and fails everything on
+ * the queue with TWI_TIMEOUT.
+ *
+ * twiWait() spins until a transaction is finished or has timed out.
+ * It is only for setup() and other code that already blocks.
+ */
+
+const uint32_t TWI_FREQUENCY = 100000;
+const uint8_t TWI_QUEUE_SIZE = 4;
+const uint8_t TWI_TIMEOUT_MS = 20;  // the longest transaction takes about 2ms
+
+enum TwiStatus : uint8_t { TWI_OK, TWI_PENDING, TWI_NACK_ADDRESS, TWI_NACK_DATA, TWI_BUS_ERROR, TWI_TIMEOUT };
+
+struct TwiTransaction {
+  uint8_t address;  // 7 bit, right justified
+  const uint8_t *txData;
+  uint8_t txLength;
+  uint8_t *rxData;
+  uint8_t rxLength;
+  void (*callback)(TwiTransaction *transaction);
+  volatile TwiStatus status;
+};
+
+void twiInit();
+bool twiPost(TwiTransaction *transaction);
+TwiStatus twiWait(TwiTransaction *transaction);
+void twiCheck();
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include "pins.h"
+#include "twi.h"
 
 void flashLeds(int count) {
   while (count--) {
@@ -23,18 +24,21 @@ void flashLeds(int count) {
 
 
 void i2cScan() {
-  byte error, address;
+  byte address;
   int nDevices;
+  TwiTransaction probe = {0, nullptr, 0, nullptr, 0, nullptr, TWI_OK};
 
   nDevices = 0;
   for (address = 1; address < 127; address++) {
-    // The i2c_scanner uses the return value of
-    // the Write.endTransmisstion to see if
-    // a device did acknowledge to the address.
-    Wire.beginTransmission(address);
-    error = Wire.endTransmission();
+    // An empty write tells us if a device
+    // acknowledges its address.
+    probe.address = address;
+    if (not twiPost(&probe)) {
+      continue;
+    }
+    TwiStatus status = twiWait(&probe);
 
-    if (error == 0) {
+    if (status == TWI_OK) {
       Serial.print("I2C device found at address 0x");
       if (address < 16)
         Serial.print("0");
@@ -42,7 +46,7 @@ void i2cScan() {
       Serial.println("  !");
 
       nDevices++;
-    } else if (error == 4) {
+    } else if (status == TWI_BUS_ERROR || status == TWI_TIMEOUT) {
       Serial.print("Unknown error at address 0x");
       if (address < 16)
         Serial.print("0");
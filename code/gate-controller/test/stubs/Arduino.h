@@ -0,0 +1,89 @@
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+/***
+ * Just enough of the Arduino core and the ATmega328 registers for the
+ * controller modules to build on the host in [env:native].
+ *
+ * The registers are plain variables. A test that drives a module
+ * through its interrupts sets them, and calls the ISR functions, to
+ * play the part of the hardware. ISR(vector) defines an ordinary
+ * function called vector. millis() returns stubMillis, which a test
+ * moves on itself, and Serial keeps everything written to it in
+ * Serial.output.
+ *
+ * Nothing here is used by the firmware build.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#ifndef F_CPU
+#define F_CPU 16000000L
+#endif
+
+// clang-format off
+inline volatile uint8_t SREG, ACSR, ADCSRA, ADCSRB, ADMUX, DIDR0, DIDR1;
+inline volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+inline volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B, ADC;
+
+const uint8_t TOV1 = 0, OCF1A = 1, OCF1B = 2, ICF1 = 5;
+const uint8_t TOIE1 = 0, OCIE1A = 1, OCIE1B = 2, ICIE1 = 5;
+const uint8_t CS10 = 0, CS11 = 1, CS12 = 2, ICES1 = 6, ICNC1 = 7;
+const uint8_t ACIS0 = 0, ACIS1 = 1, ACIC = 2, ACIE = 3, ACI = 4, ACO = 5, ACBG = 6, ACD = 7;
+const uint8_t AIN0D = 0, AIN1D = 1, ACME = 6;
+const uint8_t ADPS0 = 0, ADPS1 = 1, ADPS2 = 2, ADIE = 3, ADIF = 4, ADATE = 5, ADSC = 6, ADEN = 7, REFS0 = 6;
+// clang-format on
+
+#define _BV(bit) (1 << (bit))
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bit_is_set(reg, bit) ((reg) & _BV(bit))
+#define bit_is_clear(reg, bit) (!((reg) & _BV(bit)))
+#define ISR(vector) void vector()
+
+inline void cli() {}
+inline void sei() {}
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+enum { LOW = 0, HIGH = 1, INPUT = 0, OUTPUT = 1, INPUT_PULLUP = 2 };
+enum { A0 = 14, A1, A2, A3, A4, A5, A6, A7 };
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {}
+inline int digitalRead(uint8_t pin) {
+  return HIGH;
+}
+inline void delayMicroseconds(unsigned int us) {}
+
+inline uint32_t stubMillis;
+inline unsigned long millis() {
+  return stubMillis;
+}
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long baud) {}
+  int availableForWrite() { return 63; }
+  size_t write(const uint8_t *data, size_t length) {
+    output.append((const char *)data, length);
+    return length;
+  }
+  std::string output;
+};
+
+inline HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,216 @@
+/***
+ * Delivery of run times to the host, with a host that follows the
+ * rules in hostlink.h.
+ *
+ * The test moves millis() on in 10ms steps, calls hostUpdate() and
+ * reads the text lines from Serial. The host takes each run time once,
+ * acknowledges it and can lose run times on the way in and
+ * acknowledgements on the way out. Watchdogs and other messages go
+ * between the run times as they do on the controller.
+ */
+
+#include <unity.h>
+#include "hostlink.cpp"
+#include "timestamp.cpp"
+
+// corrected time is the same as raw time here
+uint64_t disciplineCorrect(uint64_t rawMicros) {
+  return rawMicros;
+}
+
+const uint8_t MSG_Watchdog = 0;
+const uint8_t MSG_C1RunTime = 13;
+const uint16_t RUNS = 1000;
+
+static uint32_t sRandom;
+static uint16_t sTaken[RUNS];  // how many times each run time was taken
+static uint16_t sCopies;       // run times seen without a sequence number
+static bool sSeen[256];
+static uint8_t sLosePercent;
+
+static uint32_t nextRandom(uint32_t range) {
+  sRandom = sRandom * 1664525UL + 1013904223UL;
+  return (sRandom >> 8) % range;
+}
+
+static bool lose() {
+  return nextRandom(100) < sLosePercent;
+}
+
+static void hostSays(const char *text) {
+  while (*text) {
+    hostReceive(*text++);
+  }
+}
+
+// take one line from the controller as the host would
+static void hostLine(const std::string &line) {
+  unsigned type;
+  unsigned long value;
+  unsigned sequence;
+  if (sscanf(line.c_str(), "<%u,%lu>#%u", &type, &value, &sequence) == 3) {
+    TEST_ASSERT_LESS_THAN(256, sequence);
+    if (lose()) {
+      return;
+    }
+    if (not sSeen[sequence]) {
+      sSeen[sequence] = true;
+      for (uint16_t n = HOST_WINDOW; n <= 128; n++) {
+        sSeen[(sequence + n) & 0xFF] = false;
+      }
+      sTaken[value]++;
+    }
+    if (not lose()) {
+      char ack[8];
+      snprintf(ack, sizeof(ack), "!%u\r\n", sequence);
+      hostSays(ack);
+    }
+  } else if (sscanf(line.c_str(), "<%u,%lu>", &type, &value) == 2 && type == MSG_C1RunTime) {
+    sCopies++;
+  }
+}
+
+static void step() {
+  stubMillis += 10;
+  hostUpdate();
+  size_t end;
+  while ((end = Serial.output.find("\r\n")) != std::string::npos) {
+    hostLine(Serial.output.substr(0, end));
+    Serial.output.erase(0, end + 2);
+  }
+}
+
+static void runFor(uint32_t milliseconds) {
+  for (uint32_t t = 0; t < milliseconds; t += 10) {
+    step();
+  }
+}
+
+void setUp(void) {
+  sRandom = 12345;
+  stubMillis = 0;
+  sCopies = 0;
+  sLosePercent = 0;
+  memset(sTaken, 0, sizeof(sTaken));
+  memset(sSeen, 0, sizeof(sSeen));
+  Serial.output.clear();
+  timestampInit();
+  hostInit(HOST_BAUD, HOST_TEXT);
+}
+
+void tearDown(void) {}
+
+// the existing host never acknowledges so it gets each run time once
+void test_sent_once_without_acknowledgements(void) {
+  TEST_ASSERT_TRUE(hostSendReliable(MSG_C1RunTime, 12345, F(" RUN TIME")));
+  runFor(30000);
+  TEST_ASSERT_EQUAL_UINT16(1, sCopies);
+  TEST_ASSERT_EQUAL_UINT8(0, hostUnacked());
+  TEST_ASSERT_EQUAL_UINT8(0, hostLost());
+}
+
+// with acknowledgements on and nothing lost, one send is enough
+void test_acknowledged_once(void) {
+  hostSays("!\r\n");
+  TEST_ASSERT_TRUE(hostSendReliable(MSG_C1RunTime, 7, F(" RUN TIME")));
+  step();
+  TEST_ASSERT_EQUAL_UINT8(0, hostUnacked());
+  runFor(30000);
+  TEST_ASSERT_EQUAL_UINT16(1, sTaken[7]);
+  TEST_ASSERT_EQUAL_UINT16(0, sCopies);
+}
+
+// an unanswered run time is given up after HOST_TRIES sends
+void test_given_up(void) {
+  hostSays("!\r\n");
+  sLosePercent = 100;
+  hostSendReliable(MSG_C1RunTime, 1, F(" RUN TIME"));
+  runFor(30000);
+  TEST_ASSERT_EQUAL_UINT8(0, hostUnacked());
+  TEST_ASSERT_EQUAL_UINT8(1, hostLost());
+}
+
+// run times sent faster than they are acknowledged wait for a slot and all arrive once
+void test_held_until_slot_frees(void) {
+  hostSays("!\r\n");
+  sLosePercent = 100;
+  for (uint8_t i = 0; i < HOST_WINDOW + HOST_PENDING; i++) {
+    TEST_ASSERT_TRUE(hostSendReliable(MSG_C1RunTime, i, F(" RUN TIME")));
+  }
+  TEST_ASSERT_EQUAL_UINT8(HOST_WINDOW + HOST_PENDING, hostUnacked());
+  // with nothing left to wait in, the next one is given up and counted
+  TEST_ASSERT_FALSE(hostSendReliable(MSG_C1RunTime, 99, F(" RUN TIME")));
+  TEST_ASSERT_EQUAL_UINT8(1, hostLost());
+  runFor(1000);
+  sLosePercent = 0;
+  runFor(60000);
+  TEST_ASSERT_EQUAL_UINT8(0, hostUnacked());
+  TEST_ASSERT_EQUAL_UINT8(1, hostLost());
+  for (uint8_t i = 0; i < HOST_WINDOW + HOST_PENDING; i++) {
+    TEST_ASSERT_EQUAL_UINT16(1, sTaken[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT16(0, sTaken[99]);
+}
+
+// without acknowledgements, run times wait for room in a full queue rather than being dropped
+void test_held_until_queue_has_room(void) {
+  for (uint8_t i = 0; i < HOST_QUEUE_SIZE; i++) {
+    hostSend(MSG_Watchdog, i);
+  }
+  TEST_ASSERT_TRUE(hostSendReliable(MSG_C1RunTime, 1, F(" RUN TIME")));
+  TEST_ASSERT_EQUAL_UINT8(0, hostDropped());
+  runFor(1000);
+  TEST_ASSERT_EQUAL_UINT16(1, sCopies);
+  TEST_ASSERT_EQUAL_UINT8(0, hostUnacked());
+}
+
+/***
+ * Enough run times for the sequence numbers to wrap several times,
+ * with a watchdog every second and a burst of other messages with
+ * each run time. A third of the run times and a third of the
+ * acknowledgements are lost. None may be taken twice and each one
+ * must be taken unless it was given up.
+ */
+void test_sequence_wrap_with_losses(void) {
+  hostSays("!\r\n");
+  sLosePercent = 33;
+  uint16_t next = 0;
+  uint32_t watchdog = 0;
+  uint32_t sendAt = 0;
+  while (next < RUNS || hostUnacked() > 0) {
+    if (stubMillis >= watchdog) {
+      hostSend(MSG_Watchdog, stubMillis / 1000, F(" WATCHDOG"));
+      watchdog += 1000;
+    }
+    // faster than a real contest, but no faster than the window can clear
+    if (next < RUNS && stubMillis >= sendAt && hostUnacked() < HOST_WINDOW) {
+      TEST_ASSERT_TRUE(hostSendReliable(MSG_C1RunTime, next, F(" RUN TIME")));
+      next++;
+      for (uint8_t i = 0; i < 3; i++) {
+        hostSend(1, i);
+      }
+      sendAt = stubMillis + 10 * nextRandom(100);
+    }
+    step();
+  }
+  runFor(30000);
+  uint16_t taken = 0;
+  for (uint16_t i = 0; i < RUNS; i++) {
+    TEST_ASSERT_LESS_OR_EQUAL_UINT16(1, sTaken[i]);
+    taken += sTaken[i];
+  }
+  // a run time that was taken but never heard to be is given up too
+  TEST_ASSERT_GREATER_OR_EQUAL(RUNS, taken + hostLost());
+  TEST_ASSERT_LESS_THAN(RUNS / 20, hostLost());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_sent_once_without_acknowledgements);
+  RUN_TEST(test_acknowledged_once);
+  RUN_TEST(test_given_up);
+  RUN_TEST(test_held_until_slot_frees);
+  RUN_TEST(test_held_until_queue_has_room);
+  RUN_TEST(test_sequence_wrap_with_losses);
+  return UNITY_END();
+}
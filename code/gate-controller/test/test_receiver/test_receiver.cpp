@@ -0,0 +1,391 @@
+/***
+ * The input capture radio decoder, run against a simulated Timer 1.
+ *
+ * The simulation keeps the time in half microsecond ticks and plays
+ * the part of the timer and the analog comparator. TCNT1 follows the
+ * time, the overflow and compare A interrupts are called when they
+ * fall due and an edge of the radio line latches ICR1, if it is the
+ * edge selected by ICES1, and calls the capture interrupt some time
+ * later. That delay stands for the other interrupts and the blocked
+ * sections of the loop that can hold off the capture interrupt on the
+ * real controller.
+ *
+ * The waveforms have the bit edges moved at random, as a cheap radio
+ * does, and the characters wander across the 16 bit timer wraps.
+ *
+ * The systick can be made to hold off the capture and compare A
+ * interrupts for the first part of every 2ms period, as an interrupt
+ * with the others masked does. Interrupts that fall due in that time
+ * run as soon as it ends, capture first.
+ */
+
+#include <unity.h>
+#include "receiver.cpp"
+#include "timestamp.cpp"
+
+const uint16_t MAX_JITTER = 40;   // ticks, 20us either way on every edge
+const uint16_t MAX_LATENCY = 150;  // ticks, 75us before the capture interrupt runs
+const uint16_t SYSTICK_TICKS = 4000;  // 2ms
+
+static uint64_t sNow;
+static bool sLine;
+static bool sCapturePending;
+static uint64_t sServiceAt;
+static uint32_t sRandom;
+static uint16_t sLatency;
+static uint16_t sHoldOff;  // ticks at the start of each systick period
+static bool sComparePending;
+static uint64_t sCompareAt;
+
+static uint32_t nextRandom(uint32_t range) {
+  sRandom = sRandom * 1664525UL + 1013904223UL;
+  return (sRandom >> 8) % range;
+}
+
+static int32_t jitter() {
+  return (int32_t)nextRandom(2 * MAX_JITTER + 1) - MAX_JITTER;
+}
+
+// the comparator output is high while the line is low
+static void setComparator() {
+  if (sLine) {
+    bitClear(ACSR, ACO);
+  } else {
+    bitSet(ACSR, ACO);
+  }
+}
+
+/***
+ * An interrupt flag is cleared by writing a one to it. The registers
+ * here are plain variables so the flags that the code writes are
+ * just thrown away once the ISR has returned.
+ */
+static void afterIsr() {
+  TIFR1 = 0;
+}
+
+// when an interrupt that falls due at this time can run
+static uint64_t serviceTime(uint64_t due) {
+  uint16_t phase = due % SYSTICK_TICKS;
+  return phase < sHoldOff ? due - phase + sHoldOff : due;
+}
+
+// move the time on, calling any interrupts that fall due on the way
+static void runTo(uint64_t time) {
+  while (sNow < time) {
+    uint64_t next = time;
+    uint64_t overflow = (sNow | 0xFFFF) + 1;
+    if (overflow < next) {
+      next = overflow;
+    }
+    uint64_t compare = UINT64_MAX;
+    if (bit_is_set(TIMSK1, OCIE1A) && not sComparePending) {
+      uint16_t ahead = OCR1A - (uint16_t)sNow;
+      compare = sNow + (ahead ? ahead : 0x10000);
+      if (compare < next) {
+        next = compare;
+      }
+    }
+    if (sComparePending && sCompareAt < next) {
+      next = sCompareAt;
+    }
+    if (sCapturePending && sServiceAt < next) {
+      next = sServiceAt;
+    }
+    sNow = next;
+    TCNT1 = (uint16_t)sNow;
+    if (sNow == overflow && bit_is_set(TIMSK1, TOIE1)) {
+      TIMER1_OVF_vect();
+      afterIsr();
+    }
+    if (sNow == compare) {
+      sComparePending = true;
+      sCompareAt = serviceTime(compare);
+    }
+    if (sCapturePending && sNow == sServiceAt) {
+      sCapturePending = false;
+      TIMER1_CAPT_vect();
+      // a new frame clears the compare flag it may have left pending
+      if (bit_is_set(TIFR1, OCF1A)) {
+        sComparePending = false;
+      }
+      afterIsr();
+    }
+    if (sComparePending && sNow == sCompareAt) {
+      sComparePending = false;
+      if (bit_is_set(TIMSK1, OCIE1A)) {
+        TIMER1_COMPA_vect();
+        afterIsr();
+      }
+    }
+  }
+}
+
+static void edge(uint64_t time, bool level) {
+  runTo(time);
+  if (level == sLine) {
+    return;
+  }
+  sLine = level;
+  setComparator();
+  bool comparatorRose = not level;
+  if (bit_is_set(TIMSK1, ICIE1) && comparatorRose == (bool)bit_is_set(TCCR1B, ICES1)) {
+    ICR1 = (uint16_t)sNow;
+    if (not sCapturePending) {
+      sCapturePending = true;
+      sServiceAt = serviceTime(sNow + 1 + nextRandom(sLatency + 1));
+    }
+  }
+}
+
+/***
+ * Send a character starting at the given time. Each bit edge is moved
+ * by up to MAX_JITTER, except the start edge when it is told not to
+ * so that a test can know the exact time. Returns the time at which
+ * the stop bit ends.
+ */
+static uint64_t sendChar(uint64_t start, uint8_t c, bool stopBit = true, bool jitterStart = true) {
+  edge(start + (jitterStart ? jitter() : 0), false);
+  bool level = false;
+  for (uint8_t bit = 1; bit <= 9; bit++) {
+    bool next = bit < 9 ? (c >> (bit - 1)) & 1 : stopBit;
+    if (next != level) {
+      edge(start + bit * RX_BIT_TICKS + jitter(), next);
+      level = next;
+    }
+  }
+  uint64_t end = start + RX_CHAR_TICKS;
+  if (not stopBit) {
+    edge(end + jitter(), true);
+  }
+  return end;
+}
+
+void setUp(void) {
+  sNow = 0;
+  sLine = true;
+  sCapturePending = false;
+  sRandom = 12345;
+  sLatency = MAX_LATENCY;
+  sHoldOff = 0;
+  sComparePending = false;
+  SREG = 0;
+  TIMSK1 = 0;
+  TCCR1B = 0;
+  timestampInit();
+  rxInit();
+  afterIsr();
+  setComparator();
+}
+
+void tearDown(void) {}
+
+// characters in a row with no gaps, as the detector sends them
+void test_back_to_back_characters(void) {
+  const char *text = "*A0123004567b#*B1456001234c#";
+  uint64_t start = 1000;
+  uint64_t ends[32];
+  uint8_t count = strlen(text);
+  for (uint8_t i = 0; i < count; i++) {
+    ends[i] = sendChar(start, text[i], true, false);
+    start = ends[i];
+  }
+  runTo(start + RX_CHAR_TICKS);
+  char c;
+  uint32_t time;
+  for (uint8_t i = 0; i < count; i++) {
+    TEST_ASSERT_TRUE(rxRead(c, time));
+    TEST_ASSERT_EQUAL_CHAR(text[i], c);
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)ends[i], time);
+  }
+  TEST_ASSERT_FALSE(rxRead(c, time));
+  TEST_ASSERT_EQUAL_UINT8(0, rxFramingErrors());
+}
+
+// every byte value, with jitter on every edge and timer wraps all the way through
+void test_every_byte_with_jitter(void) {
+  char c;
+  uint32_t time;
+  for (uint16_t pass = 0; pass < 4; pass++) {
+    for (uint16_t value = 0; value < 256; value++) {
+      // a random gap so the start edges fall anywhere in the timer count
+      uint64_t start = sNow + MAX_JITTER + nextRandom(3 * RX_CHAR_TICKS);
+      uint64_t end = sendChar(start, value);
+      runTo(end + RX_BIT_TICKS);
+      TEST_ASSERT_TRUE(rxRead(c, time));
+      TEST_ASSERT_EQUAL_UINT8(value, (uint8_t)c);
+      int32_t error = (int32_t)(time - (uint32_t)end);
+      TEST_ASSERT_INT_WITHIN(MAX_JITTER, 0, error);
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(0xFFFF, sNow);
+  TEST_ASSERT_EQUAL_UINT8(0, rxFramingErrors());
+  TEST_ASSERT_EQUAL_UINT8(0, rxOverruns());
+}
+
+// short pulses between packets, from interference, do not make a character
+void test_glitches_are_ignored(void) {
+  uint64_t t = 1000;
+  for (uint8_t i = 0; i < 20; i++) {
+    uint16_t width = 1 + nextRandom(RX_BIT_TICKS / 2 - MAX_LATENCY);
+    edge(t, false);
+    edge(t + width, true);
+    t += RX_CHAR_TICKS;
+  }
+  uint64_t end = sendChar(t, '#');
+  runTo(end + RX_BIT_TICKS);
+  char c;
+  uint32_t time;
+  TEST_ASSERT_TRUE(rxRead(c, time));
+  TEST_ASSERT_EQUAL_CHAR('#', c);
+  TEST_ASSERT_FALSE(rxRead(c, time));
+}
+
+// a low stop bit is counted and the character is thrown away
+void test_bad_stop_bit(void) {
+  uint64_t end = sendChar(1000, 'A', false);
+  end = sendChar(end + RX_CHAR_TICKS, 'B');
+  runTo(end + RX_BIT_TICKS);
+  char c;
+  uint32_t time;
+  TEST_ASSERT_TRUE(rxRead(c, time));
+  TEST_ASSERT_EQUAL_CHAR('B', c);
+  TEST_ASSERT_FALSE(rxRead(c, time));
+  TEST_ASSERT_EQUAL_UINT8(1, rxFramingErrors());
+}
+
+// nothing is read for a while so the queue fills and the rest are counted
+void test_overrun(void) {
+  uint64_t start = 1000;
+  for (uint8_t i = 0; i < RX_QUEUE_SIZE + 3; i++) {
+    start = sendChar(start, 'a' + i % 26);
+  }
+  runTo(start + RX_BIT_TICKS);
+  TEST_ASSERT_EQUAL_UINT8(3, rxOverruns());
+  char c;
+  uint32_t time;
+  TEST_ASSERT_TRUE(rxRead(c, time));
+  TEST_ASSERT_EQUAL_CHAR('a', c);
+}
+
+// the radio sends from the detector's own clock, which can be 0.5% out
+void test_transmitter_clock_error(void) {
+  const char *text = "A0123004567b#";
+  for (int8_t sign = -1; sign <= 1; sign += 2) {
+    rxFlush();
+    uint64_t start = sNow + RX_CHAR_TICKS;
+    for (uint8_t i = 0; i < strlen(text); i++) {
+      uint64_t bitStart = start;
+      edge(bitStart, false);
+      bool level = false;
+      int32_t bit = RX_BIT_TICKS + sign * 2;  // 0.5%
+      for (uint8_t b = 1; b <= 9; b++) {
+        bool next = b < 9 ? (text[i] >> (b - 1)) & 1 : true;
+        if (next != level) {
+          edge(bitStart + b * bit, next);
+          level = next;
+        }
+      }
+      start = bitStart + 10 * bit;
+    }
+    runTo(start + RX_BIT_TICKS);
+    char c;
+    uint32_t time;
+    for (uint8_t i = 0; i < strlen(text); i++) {
+      TEST_ASSERT_TRUE(rxRead(c, time));
+      TEST_ASSERT_EQUAL_CHAR(text[i], c);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, rxFramingErrors());
+}
+
+/***
+ * Packets from the detector, back to back characters with gaps between
+ * the packets, with the systick holding off the receiver interrupts
+ * for a given time in every 2ms. Counts the packets that arrive intact
+ * and finds the worst error in the character times. The systick falls
+ * at a different point in each packet.
+ */
+struct HoldOffResult {
+  uint16_t intact;
+  uint16_t worstError;  // ticks
+};
+
+static HoldOffResult packetsWithHoldOff(uint16_t holdOffUs, uint16_t packets) {
+  const char *text = "*A0123004567b#";
+  const uint8_t length = strlen(text);
+  setUp();
+  sHoldOff = holdOffUs * TIMESTAMP_TICKS_PER_US;
+  HoldOffResult result = {0, 0};
+  for (uint16_t p = 0; p < packets; p++) {
+    uint64_t start = sNow + MAX_JITTER + nextRandom(3 * RX_CHAR_TICKS);
+    uint64_t ends[16];
+    for (uint8_t i = 0; i < length; i++) {
+      ends[i] = sendChar(start, text[i]);
+      start = ends[i];
+    }
+    runTo(start + RX_CHAR_TICKS);
+    char c;
+    uint32_t time;
+    uint8_t count = 0;
+    bool intact = true;
+    while (rxRead(c, time)) {
+      if (count < length && c == text[count]) {
+        int32_t error = (int32_t)(time - (uint32_t)ends[count]);
+        uint16_t size = error < 0 ? -error : error;
+        if (size > result.worstError) {
+          result.worstError = size;
+        }
+      } else {
+        intact = false;
+      }
+      count++;
+    }
+    if (intact && count == length) {
+      result.intact++;
+    }
+  }
+  return result;
+}
+
+/***
+ * How long a systick can hold off the receiver. Four analogRead()
+ * calls took about 450us, which is more than two bit times, so the
+ * capture interrupt could miss edges and the frame end could run into
+ * the next start bit. The systick now only compares readings from the
+ * ADC scanner, and MSG_SystickWorst reports how long it really takes.
+ * With the other interrupts adding up to MAX_LATENCY on top, it must
+ * stay under 50us. The time error is for characters that arrived in
+ * their right place in the packet, so a lost character can show up as
+ * a whole character time.
+ */
+void test_systick_hold_off(void) {
+  const uint16_t PACKETS = 200;
+  const uint16_t HOLD_OFFS[] = {0, 25, 50, 100, 150, 200, 300, 450};
+  char message[100];
+  for (uint16_t holdOff : HOLD_OFFS) {
+    HoldOffResult result = packetsWithHoldOff(holdOff, PACKETS);
+    snprintf(message, sizeof(message), "systick %3uus: %3u/%u packets intact, worst time error %uus", holdOff, result.intact,
+             PACKETS, result.worstError / TIMESTAMP_TICKS_PER_US);
+    TEST_MESSAGE(message);
+    if (holdOff <= 50) {
+      TEST_ASSERT_EQUAL_UINT16(PACKETS, result.intact);
+      TEST_ASSERT_LESS_OR_EQUAL_UINT16(MAX_JITTER, result.worstError);
+    }
+    if (holdOff == 450) {
+      TEST_ASSERT_LESS_THAN(PACKETS, result.intact);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_back_to_back_characters);
+  RUN_TEST(test_every_byte_with_jitter);
+  RUN_TEST(test_glitches_are_ignored);
+  RUN_TEST(test_bad_stop_bit);
+  RUN_TEST(test_overrun);
+  RUN_TEST(test_transmitter_clock_error);
+  RUN_TEST(test_systick_hold_off);
+  return UNITY_END();
+}
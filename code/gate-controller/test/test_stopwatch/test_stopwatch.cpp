@@ -0,0 +1,176 @@
+/***
+ * The stopwatch on the Timer 1 timestamp clock, run against a
+ * simulated timer.
+ *
+ * The simulation keeps the time in half microsecond ticks. TCNT1
+ * follows the low 16 bits and the overflow interrupt is called each
+ * time it wraps. Long spans are jumped over by setting the overflow
+ * count directly, as if the interrupt had run that many times, so the
+ * tests can start days or weeks after power up.
+ *
+ * The discipline is left out. disciplinedMicros() is timestampMicros()
+ * here, which is what it is until the first RTC measurement.
+ */
+
+#include <unity.h>
+#include "stopwatch.cpp"
+#include "timestamp.cpp"
+
+uint64_t disciplinedMicros() {
+  return timestampMicros();
+}
+
+const uint64_t TICKS_PER_SECOND = 2000000;
+const uint64_t MILLIS_WRAP_US = 4294967296ULL * 1000;  // where millis() wrapped, 49.7 days
+const uint64_t TICKS_WRAP = 4294967296ULL;              // where timestamp() wraps, 35.8 minutes
+
+static uint64_t sNow;  // ticks
+
+// start the clock at any time, as if it had been running since zero
+static void setTime(uint64_t ticks) {
+  sNow = ticks;
+  sOverflows = ticks >> 16;
+  TCNT1 = (uint16_t)ticks;
+  TIFR1 = 0;
+}
+
+// move the time on, calling the overflow interrupt as the timer wraps
+static void advance(uint64_t ticks) {
+  uint64_t end = sNow + ticks;
+  while (sNow < end) {
+    uint64_t overflow = (sNow | 0xFFFF) + 1;
+    if (overflow > end) {
+      sNow = end;
+      TCNT1 = (uint16_t)sNow;
+      break;
+    }
+    sNow = overflow;
+    TCNT1 = 0;
+    TIMER1_OVF_vect();
+  }
+}
+
+static void advanceMicros(uint64_t micros) {
+  advance(micros * TIMESTAMP_TICKS_PER_US);
+}
+
+void setUp(void) {
+  timestampInit();
+  setTime(0);
+}
+
+void tearDown(void) {}
+
+void test_microsecond_resolution(void) {
+  Stopwatch watch;
+  watch.start();
+  advance(3);
+  TEST_ASSERT_EQUAL_UINT64(1, watch.elapsedMicros());
+  advanceMicros(1234566);
+  TEST_ASSERT_EQUAL_UINT64(1234567, watch.elapsedMicros());
+  TEST_ASSERT_EQUAL_UINT32(1234, watch.time());
+}
+
+// a run that crosses the 35 minute wrap of timestamp() and the 49.7 day wrap of millis()
+void test_no_wrap(void) {
+  setTime(MILLIS_WRAP_US * TIMESTAMP_TICKS_PER_US - 10 * TICKS_PER_SECOND);
+  Stopwatch watch;
+  watch.start();
+  advance(TICKS_WRAP + 20 * TICKS_PER_SECOND);
+  uint64_t expected = (TICKS_WRAP + 20 * TICKS_PER_SECOND) / TIMESTAMP_TICKS_PER_US;
+  TEST_ASSERT_EQUAL_UINT64(expected, watch.elapsedMicros());
+  TEST_ASSERT_EQUAL_UINT32(expected / 1000, watch.time());
+}
+
+// the overflow has happened but its interrupt has not run yet
+void test_pending_overflow(void) {
+  setTime(0x2FFF0);
+  uint32_t before = timestamp();
+  TCNT1 = 0x0005;
+  bitSet(TIFR1, TOV1);
+  TEST_ASSERT_EQUAL_UINT32(0x30005, timestamp());
+  TEST_ASSERT_GREATER_THAN(before, timestamp());
+  TIMER1_OVF_vect();
+  TIFR1 = 0;
+  TEST_ASSERT_EQUAL_UINT32(0x30005, timestamp());
+}
+
+// a gate event decoded some time after it happened
+void test_stop_at_event_time(void) {
+  Stopwatch watch;
+  watch.start();
+  advanceMicros(10000000);
+  uint32_t eventTicks = timestamp() - 5000;  // 2.5ms ago
+  advanceMicros(4000);                       // decoding the packet
+  watch.stop(timestampMicrosAt(eventTicks));
+  advanceMicros(5000000);
+  TEST_ASSERT_FALSE(watch.running());
+  TEST_ASSERT_EQUAL_UINT64(10000000 - 2500, watch.elapsedMicros());
+  TEST_ASSERT_EQUAL_UINT32(9997, watch.time());
+}
+
+void test_restart_at_event_time(void) {
+  Stopwatch watch;
+  advanceMicros(1000000);
+  uint64_t event = timestampMicros();
+  advanceMicros(3000);
+  watch.restart(event);
+  TEST_ASSERT_TRUE(watch.running());
+  TEST_ASSERT_EQUAL_UINT64(3000, watch.elapsedMicros());
+}
+
+// an event time from a button that is a little before the start
+void test_event_before_start(void) {
+  Stopwatch watch;
+  advanceMicros(1000);
+  uint64_t early = timestampMicros();
+  advanceMicros(1000);
+  watch.start();
+  advanceMicros(1000);
+  watch.stop(early);
+  TEST_ASSERT_EQUAL_UINT64(0, watch.elapsedMicros());
+}
+
+// stopping again does not move the stop time
+void test_stop_only_once(void) {
+  Stopwatch watch;
+  watch.start();
+  advanceMicros(2000);
+  watch.stop();
+  advanceMicros(2000);
+  watch.stop();
+  TEST_ASSERT_EQUAL_UINT64(2000, watch.elapsedMicros());
+}
+
+void test_lap(void) {
+  Stopwatch watch;
+  watch.start();
+  advanceMicros(1500000);
+  TEST_ASSERT_EQUAL_UINT32(1500, watch.lap());
+  advanceMicros(700000);
+  TEST_ASSERT_EQUAL_UINT32(700, watch.time());
+}
+
+// an event from 30 minutes ago, after timestamp() has wrapped
+void test_micros_at_across_wrap(void) {
+  setTime(TICKS_WRAP - 100 * TICKS_PER_SECOND);
+  uint32_t eventTicks = timestamp();
+  uint64_t eventMicros = timestampMicros();
+  advance(30 * 60 * TICKS_PER_SECOND);
+  TEST_ASSERT_LESS_THAN(eventTicks, timestamp());
+  TEST_ASSERT_EQUAL_UINT64(eventMicros, timestampMicrosAt(eventTicks));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_microsecond_resolution);
+  RUN_TEST(test_no_wrap);
+  RUN_TEST(test_pending_overflow);
+  RUN_TEST(test_stop_at_event_time);
+  RUN_TEST(test_restart_at_event_time);
+  RUN_TEST(test_event_before_start);
+  RUN_TEST(test_stop_only_once);
+  RUN_TEST(test_lap);
+  RUN_TEST(test_micros_at_across_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,65 @@
+#include "adc.h"
+#include "timestamp.h"
+
+static uint8_t sChannels[ADC_MAX_CHANNELS];
+static uint8_t sChannelCount;
+static uint8_t sResultIndex;   // channel of the conversion just completed
+static uint8_t sPendingIndex;  // channel of the conversion now in progress
+static AdcHandler sHandler;
+
+/***
+ * The pins are given as Arduino analogue pin numbers (A0, A1 ...).
+ * The index passed to the handler is the position of the pin in the
+ * list, not the ADC channel number.
+ */
+void adcScanInit(const uint8_t *pins, uint8_t count, AdcHandler handler) {
+  adcScanStop();
+  if (count > ADC_MAX_CHANNELS) {
+    count = ADC_MAX_CHANNELS;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    sChannels[i] = (pins[i] >= A0) ? pins[i] - A0 : pins[i];
+    // the digital input buffers only add noise on an analogue input
+    if (sChannels[i] < 6) {
+      bitSet(DIDR0, sChannels[i]);
+    }
+  }
+  sChannelCount = count;
+  sHandler = handler;
+  sResultIndex = 0;
+  sPendingIndex = 0;
+  if (sChannelCount == 0 || sHandler == nullptr) {
+    return;
+  }
+  // AVcc reference, as used by analogRead()
+  ADMUX = _BV(REFS0) | sChannels[0];
+  // free running mode
+  ADCSRB = 0;
+  // prescaler = 64, auto trigger, interrupt on completion
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1);
+  bitSet(ADCSRA, ADSC);
+}
+
+void adcScanStop() {
+  bitClear(ADCSRA, ADIE);
+  bitClear(ADCSRA, ADATE);
+}
+
+ISR(ADC_vect) {
+  uint32_t time = timestamp();
+  int16_t value = ADC;
+  uint8_t index = sResultIndex;
+  sResultIndex = sPendingIndex;
+  if (++sPendingIndex >= sChannelCount) {
+    sPendingIndex = 0;
+  }
+  ADMUX = _BV(REFS0) | sChannels[sPendingIndex];
+  // The handler can take a good part of a conversion time. Let other
+  // interrupts, like the radio bit clock, in while it runs but make
+  // sure this one cannot nest.
+  ADCSRA &= ~(_BV(ADIE) | _BV(ADIF));
+  sei();
+  sHandler(index, value, time);
+  cli();
+  ADCSRA = (ADCSRA & ~_BV(ADIF)) | _BV(ADIE);
+}
@@ -0,0 +1,54 @@
+#ifndef ADC_H
+#define ADC_H
+
+#include <Arduino.h>
+
+/***
+ * Interrupt driven ADC scanner.
+ *
+ * The ADC runs in free-running mode so that a new conversion starts
+ * automatically as soon as the last one finishes. Nothing ever waits
+ * for a conversion. The conversion complete interrupt collects the
+ * result, moves the multiplexer on to the next channel in the list
+ * and passes the reading to a handler.
+ *
+ * The ADC clock is F_CPU/64. At 8MHz that is 125kHz, which is inside
+ * the 50-200kHz range needed for full 10 bit accuracy. A conversion
+ * takes 13 ADC clocks so there are 9615 conversions per second shared
+ * between the channels. With two sensors, each is sampled at 4807Hz.
+ *
+ * In free-running mode the next conversion has already started by
+ * the time the interrupt runs. A change to the multiplexer only takes
+ * effect for the conversion after that so the scanner keeps track of
+ * two channels - the one whose result has just arrived and the one
+ * that is in progress.
+ *
+ * The handler is called from the ISR with interrupts enabled so that
+ * it does not hold up time-critical interrupts. It must still finish
+ * well inside one conversion time. Do not use analogRead() once the
+ * scanner is running.
+ *
+ * The handler is also given the timestamp() taken as the ISR starts,
+ * before anything else has run. However long the handler itself takes,
+ * or whatever interrupts it lets in, the reading was sampled
+ * ADC_SAMPLE_AGE_US before that time.
+ */
+
+const uint8_t ADC_PRESCALER = 64;
+const uint8_t ADC_CLOCKS_PER_CONVERSION = 13;
+const uint32_t ADC_CONVERSION_RATE = F_CPU / ADC_PRESCALER / ADC_CLOCKS_PER_CONVERSION;
+const uint8_t ADC_MAX_CHANNELS = 8;
+
+/***
+ * The input is sampled 1.5 ADC clocks into a conversion and the result
+ * is ready 13 clocks after the start. At the time passed to the
+ * handler, the sample is this many microseconds old.
+ */
+const uint16_t ADC_SAMPLE_AGE_US = (2 * ADC_CLOCKS_PER_CONVERSION - 3) * (ADC_PRESCALER * 1000000UL / F_CPU) / 2;
+
+typedef void (*AdcHandler)(uint8_t index, int16_t value, uint32_t time);
+
+void adcScanInit(const uint8_t *pins, uint8_t count, AdcHandler handler);
+void adcScanStop();
+
+#endif
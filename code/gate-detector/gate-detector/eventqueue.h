@@ -0,0 +1,83 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <Arduino.h>
+
+/***
+ * A lock-free queue for passing records from one interrupt service
+ * routine to the main loop.
+ *
+ * There must be exactly one producer, the ISR, which calls push(),
+ * and one consumer, the loop, which calls peek() and pop(). Each side
+ * only ever writes its own index and the indices are single bytes so
+ * they are read and written atomically without disabling interrupts.
+ *
+ * The indices run freely and are masked when used so that a full
+ * queue can be told from an empty one without wasting a slot. SIZE
+ * must be a power of two no bigger than 128.
+ *
+ * The records themselves are not volatile. The compiler barrier makes
+ * sure a record is completely written before the head index is moved
+ * on to publish it, and that it is completely read before the tail
+ * index is moved on to release the slot.
+ *
+ * If the ISR finds the queue full, the record is counted in dropped()
+ * and thrown away. The ISR cannot wait. The count stops at 255.
+ */
+
+#define QUEUE_BARRIER() asm volatile("" ::: "memory")
+
+template <typename T, uint8_t SIZE>
+class EventQueue {
+ public:
+  static_assert(SIZE > 0 && SIZE <= 128 && (SIZE & (SIZE - 1)) == 0, "queue size must be a power of two up to 128");
+
+  // producer only
+  bool push(const T &item) {
+    uint8_t head = mHead;
+    if ((uint8_t)(head - mTail) == SIZE) {
+      if (mDropped < UINT8_MAX) {
+        mDropped++;
+      }
+      return false;
+    }
+    mItems[head & MASK] = item;
+    QUEUE_BARRIER();
+    mHead = head + 1;
+    return true;
+  }
+
+  // consumer only - copy the oldest record without removing it
+  bool peek(T &item) {
+    uint8_t tail = mTail;
+    if (tail == mHead) {
+      return false;
+    }
+    QUEUE_BARRIER();
+    item = mItems[tail & MASK];
+    return true;
+  }
+
+  // consumer only - remove the oldest record
+  void pop() {
+    QUEUE_BARRIER();
+    if (mTail != mHead) {
+      mTail = mTail + 1;
+    }
+  }
+
+  bool empty() const { return mHead == mTail; }
+
+  uint8_t count() const { return (uint8_t)(mHead - mTail); }
+
+  uint8_t dropped() const { return mDropped; }
+
+ private:
+  static const uint8_t MASK = SIZE - 1;
+  T mItems[SIZE];
+  volatile uint8_t mHead = 0;  // written only by the producer
+  volatile uint8_t mTail = 0;  // written only by the consumer
+  volatile uint8_t mDropped = 0;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef EXPFILTER_H
+#define EXPFILTER_H
+
+#include <Arduino.h>
+
+/***
+ * The exponential moving average (EMA) filter is a simple and
+ * comutationally inexpensive low pass filter.
+ *
+ * small values of alpha give low cut-off frequencies and long
+ * time constants.
+ *
+ * For a signal sampled at a frequency F, and filtered with a
+ * filter constant alpha, the time constant is
+ *
+ *  tau = 1/(F*alpha)
+ *
+ * For a step change, the filter will take 3*tau seconds to get to
+ * 95% of the new output value.
+ *
+ * The filter runs in the sampling ISR of an 8MHz ATmega328 which
+ * has no floating point hardware. Everything here is done in
+ * integer arithmetic and alpha is worked out by the compiler from
+ * the sample rate and the time constant so none of that costs
+ * anything at run time.
+ *
+ * The filter state is a signed 32 bit value holding the 10 bit ADC
+ * reading with FRAC_BITS of fraction - Q(10.FRAC_BITS) format.
+ *
+ * Alpha is held as an integer scaled by 2^ALPHA_BITS. ALPHA_BITS is
+ * chosen so that the error term multiplied by alpha can never
+ * overflow 31 bits. That leaves alpha with at least 20-FRAC_BITS
+ * bits of precision so there is a trade-off:
+ *
+ *  - long time constants need more FRAC_BITS or the very small
+ *    corrections they make each sample get lost in the rounding.
+ *    The dead band is about F*tau/2^FRAC_BITS ADC counts.
+ *  - short time constants need fewer FRAC_BITS to leave room for
+ *    an accurate alpha.
+ *
+ * For example, sampled at 1300Hz,
+ *
+ *   tau = 1.000s, FRAC_BITS = 12 gives alpha = 403/2^19 (0.000769)
+ *   tau = 0.002s, FRAC_BITS = 6  gives alpha = 25206/2^16 (0.385)
+ *
+ */
+
+// floor(log2(n)) evaluated at compile time
+constexpr uint8_t log2_floor(uint32_t n) {
+  return n < 2 ? 0 : 1 + log2_floor(n / 2);
+}
+
+template <uint16_t SAMPLE_HZ, uint16_t TAU_MS, uint8_t Q_BITS>
+class ExpFilter {
+ public:
+  static const uint8_t FRAC_BITS = Q_BITS;
+  static const uint8_t ALPHA_BITS = 21 - FRAC_BITS + log2_floor((uint32_t)SAMPLE_HZ * TAU_MS / 1000);
+  static const uint32_t ALPHA = (((uint64_t)1 << ALPHA_BITS) * 1000 + (uint32_t)SAMPLE_HZ * TAU_MS / 2) / ((uint32_t)SAMPLE_HZ * TAU_MS);
+  static const int32_t ONE = (int32_t)1 << FRAC_BITS;
+
+  static_assert((uint32_t)SAMPLE_HZ * TAU_MS >= 1000, "tau must be at least one sample period");
+  static_assert(FRAC_BITS <= 20, "not enough bits left for alpha");
+
+  ExpFilter(){};
+
+  explicit ExpFilter(int16_t value) { begin(value); };
+
+  void begin(int16_t value = 0) { mValue = (int32_t)value << FRAC_BITS; }
+
+  int32_t update(int16_t newValue) {
+    int32_t error = ((int32_t)newValue << FRAC_BITS) - mValue;
+    mValue += (error * (int32_t)ALPHA + ((int32_t)1 << (ALPHA_BITS - 1))) >> ALPHA_BITS;
+    return mValue;
+  };
+
+  // the filter output in ADC counts, rounded
+  int16_t value() const { return (int16_t)((mValue + ONE / 2) >> FRAC_BITS); }
+
+  // the filter output in Q(10.FRAC_BITS) format
+  int32_t raw() const { return mValue; }
+
+  void set_value(int16_t value) { mValue = (int32_t)value << FRAC_BITS; }
+
+  void set_raw(int32_t value) { mValue = value; }
+
+  int16_t operator()() const { return value(); }
+
+ private:
+  int32_t mValue = 0;
+};
+
+#endif
@@ -1,275 +1,136 @@
-#include "SoftwareSerial.h"
+#include "adc.h"
 #include "digitalWriteFast.h"
+#include "eventqueue.h"
+#include "gatesensor.h"
+#include "packets.h"
+#include "pins.h"
+#include "telemetry.h"
+#include "timestamp.h"
+#include "transmitter.h"
 #include <Arduino.h>
 
+// 0 = trigger timing, 1 = filter levels for the serial plotter, 2 = binary telemetry
 #define DEBUG 0
-const int sideSensorPin = A0;
-const int endSensorPin = A1;
 const int SIDE_GATE = 0;
 const int END_GATE = 1;
 
-const int RADIO_DATA = 4;
-const int RADIO_NC = 5;
-const int RADIO_PDN = 2;
-const int RADIO_TX = 3;
-
-#define GATE_ID_PIN0 9
-#define GATE_ID_PIN1 8
-#define GATE_ID_PIN2 7
-#define GATE_ID_PIN3 6
-
 int gateID = 0;
-
-const int PACKET_REPEATS = 3;
-const int PACKET_REPEAT_INTERVAL = 50;
 ////////////////////////////////////////////////////////////////////////
 
 /***
- * The exponential moving average (EMS) filter is a simple and
- * comutationally inexpensive low pass filter.
- *
- * small values of alpha give low cut-off frequencies and long
- * time constants.
- *
- * For a signal sampled at a frequency F, and filtered with a
- * filter constant alpha, the time constant is
- *
- *  tau = 1/(F*alpha)
- *
- * In this example, the slow filter has
- *
- *     F = 1300
- * alpha = 0.001
- *   tau = 1/1.3 = 0.77 seconds.
- *
- * For a step change, the filter will take 3*tau seconds to get to
- * 95% of the new output value. Here that equates to the slow filter
- * being ready in about 2.5 seconds
- *
- *
+ * The sensors are sampled by the ADC scanner. Every conversion goes to
+ * one of the sensors in turn so each one is updated at the conversion
+ * rate divided by the number of sensors. The filter constants in the
+ * gate sensors are derived from this at compile time.
  */
-class ExpFilter {
-public:
-  ExpFilter(){};
-
-  explicit ExpFilter(float alpha, float value = 0.0f) { begin(alpha, value); };
-
-  void begin(float alpha, float value = 0) {
-    mAlpha = alpha;
-    mValue = value;
-  }
-
-  float update(float newValue) {
-    mValue += mAlpha * (newValue - mValue);
-    return mValue;
-  };
-
-  void set_alpha(float alpha) { mAlpha = alpha; }
-
-  float value() { return mValue; }
-
-  void set_value(float value) { mValue = value; }
-
-  float operator()() { return mValue; }
-
-private:
-  volatile float mAlpha = 1.0f;
-  volatile float mValue = 0;
-};
+const uint8_t sensorPins[] = {sideSensorPin, endSensorPin};  // in SIDE_GATE, END_GATE order
+const uint8_t SENSOR_COUNT = sizeof(sensorPins);
+const uint16_t SAMPLE_FREQUENCY = ADC_CONVERSION_RATE / SENSOR_COUNT;
+// hold off bright pulses of up to 8 samples, 1.7ms, to ride out a camera flash
+typedef BrightBlanker<8> SensorPrefilter;
+typedef GateSensor<SAMPLE_FREQUENCY, SensorPrefilter> Sensor;
 
 ////////////////////////////////////////////////////////////////////////
-class GateSensor {
-  const uint32_t LOCKOUT_PERIOD = 50;
 
-public:
-  explicit GateSensor(int pin) : mSensorPin(pin) {
-    slow.begin(0.000769);                 // tau = 1.000 seconds
-    fast.begin((1.0 / (1300.0 * 0.002))); // tau = 0.002 seconds
-  }
-
-  void update() {
-    mInput = analogRead(mSensorPin);
-    // if (not mInterrupted) {
-    slow.update(mInput);
-    // }
-    fast.update(mInput);
-    // When sensor is occluded, light the LED. It stays on until triggered
-    if (slow.value() < 10) {
-      digitalWriteFast(LED_BUILTIN, 1);
-      return;
-    }
-    // fast recovery after lengthy occlusion
-    slow.set_value(max(slow.value(), fast.value()));
-    // mDiff just lets us know when the sensor is properly lit
-    mDiff = fabs(fast.value() - slow.value());
-    // now do the actual detection with plenty of hysteresis
-    if (fast.value() < 0.25 * slow.value()) {
-      mInterrupted = true;
-    }
-    if (fast.value() > 0.75 * slow.value()) {
-      arm();
-      mInterrupted = false;
-      mMessageSent = false;
-    }
-  }
+// the end sensor reports as 'A'-'P' and the side sensor as 'a'-'p'
+char end_sensor_id = 'A';
+char side_sensor_id = 'a';
 
-  void arm() { mArmed = true; }
+Sensor endSensor(endSensorPin);
+Sensor sideSensor(sideSensorPin);
 
-  void disarm() { mArmed = false; }
-
-  bool armed() { return mArmed; }
-
-  int mSensorPin;
-  volatile float mInput;
-  volatile float mDiff;
-  ExpFilter slow;
-  ExpFilter fast;
-  volatile bool mInterrupted = false;
-  volatile bool mMessageSent = false;
-  volatile bool mArmed = true;
+/***
+ * Every break is recorded by the sampling ISR the moment it is seen
+ * and queued for the loop. The loop hands the events to the packet
+ * scheduler in the order they happened, however many arrive together.
+ */
+struct TriggerEvent {
+  uint8_t sensor;  // SIDE_GATE or END_GATE
+  int16_t level;   // slow filter value at the time
+  uint32_t time;   // timestamp() of the break
 };
 
-////////////////////////////////////////////////////////////////////////
-
-SoftwareSerial radio(RADIO_NC, RADIO_DATA); // RX, TX
+const uint8_t TRIGGER_QUEUE_SIZE = 8;
+EventQueue<TriggerEvent, TRIGGER_QUEUE_SIZE> triggers;
 
-const uint32_t LOCKOUT_TIME = 200;
-const uint8_t HOME_BASE = 0x41;
-const uint8_t START_BASE = 0x61;
-const uint8_t GOAL_BASE = 0x30;
-// assume this is the start gate detector
-uint8_t side_sensor_base = HOME_BASE;
-uint8_t end_sensor_base = START_BASE;
-
-GateSensor endSensor(endSensorPin);
-GateSensor sideSensor(sideSensorPin);
-
-void analogueInit() {
-  // increase speed of ADC conversions
-  // by changing the clock prescaler from 128 to 32
-  bitSet(ADCSRA, ADPS0);
-  bitClear(ADCSRA, ADPS1);
-  bitSet(ADCSRA, ADPS2);
-}
-
-// the systick event is an ISR attached to Timer 2
-void systickInit() {
-  // set the mode for timer 2
-  bitClear(TCCR2A, WGM20);
-  bitSet(TCCR2A, WGM21);
-  bitClear(TCCR2B, WGM22);
-  // set divisor to 128 => timer clock = 125kHz
-  bitSet(TCCR2B, CS22);
-  bitClear(TCCR2B, CS21);
-  bitSet(TCCR2B, CS20);
-  // set the timer frequency for 1300Hz
-  OCR2A = (F_CPU / 128 / 1300) - 1; // 47
-  bitSet(TIMSK2, OCIE2A);           // enable the timer interrupt
-}
-
-ISR(TIMER2_COMPA_vect) {
-  endSensor.update();
-  if (gateID == 0) {
-    sideSensor.update();
+// called from the ADC conversion complete interrupt, time is when it started
+void sensorUpdate(uint8_t index, int16_t value, uint32_t time) {
+#if DEBUG == 2
+  telemetrySample(index, value);
+#endif
+  if (index != END_GATE && gateID != 0) {
+    return;
+  }
+  Sensor &sensor = (index == END_GATE) ? endSensor : sideSensor;
+  if (sensor.update(value)) {
+    TriggerEvent event;
+    event.sensor = index;
+    event.level = sensor.slow.value();
+    event.time = time - ADC_SAMPLE_AGE_US - sensor.mEventAge;
+    triggers.push(event);
   }
 }
 
 /***
- * In an attempt to get reliable timing from the software serial
- * strings are sent by calling directly the write method.
- *
- * At a baud rate of 5000 Baud, each character should take 2ms
- * to go out. Placing a 1ms delay between characters will let
- * the receiver calculate, from the character received, the time
- * that the first character was sent since they should be arriving
- * every 3ms.
- *
- * Software serial turns off interrupts while it is sending a byte
- * in order to get good timing.
- *
- * Here, interrupts are turned off for the duration of the entire
- * string to try and get good inter-character timing as well.
- *
- * Even so, there will be some jitter. Observations indicate that
- * this amounts to less than 250us variation between characters.
- *
- * Although a longer interval might make the system more resistant
- * to interference, it seems a good idea to get the entire packet
- * out in a short space of time. Packets contain 13 characters and
- * so should take up about 40ms transmission time.
- *
- * If messages are missed it might be a good idea to implement some
- * kind of repeat although that would considerably complicate the
- * implied timing scheme used here.
- *
+ * A break that finds the queue full is lost. The loop should never
+ * fall that far behind so, if it does, the LED comes on and stays on
+ * and the count goes to the serial port.
  */
-void sendString(char *s) {
-  uint8_t oldSREG = SREG;
-  cli();
-  while (char c = *s++) {
-    radio.write(c);
-    delayMicroseconds(1000); // actual transmission is 11 bits?
+uint8_t reported_drops = 0;
+void report_dropped_triggers() {
+  uint8_t dropped = triggers.dropped();
+  if (dropped == reported_drops) {
+    return;
   }
-  SREG = oldSREG;
+  reported_drops = dropped;
+  digitalWrite(LED_BUILTIN, 1);
+#if DEBUG == 0
+  Serial.print(F("TRIGGERS DROPPED "));
+  Serial.println(dropped);
+#endif
+}
+
+void analogueInit() {
+  adcScanInit(sensorPins, SENSOR_COUNT, sensorUpdate);
 }
 
 /***
- * The trigger message consists of a synchronising byte
- * followed by 6 data bytes and finished with a pair of
- * terminating bytes.
- *
- * The synchronising byte is used only to help the
- * receiver wake up. The receiver ignores that byte and
- * so it represents a fixed delay in the response.
- *
+ * The packets go out in the background, see packets.h. Returns false
+ * if the scheduler cannot take the event yet.
  */
-
 uint32_t last_trigger_time = millis();
-void send_trigger(uint8_t base) {
-  digitalWriteFast(LED_BUILTIN, 1);
-  digitalWrite(RADIO_DATA, 1);
-  digitalWrite(RADIO_PDN, 1);
-  digitalWrite(RADIO_TX, 1);
-  // allow the transmitter to stabilise
-  delayMicroseconds(500);
-  switch (base) {
-  case GOAL_BASE:
-    sendString("U0123456789##");
-    break;
-  case HOME_BASE:
-    sendString("UABCDEFGHIJ##");
-    break;
-  case START_BASE:
-    sendString("Uabcdefghij##");
-    break;
+bool send_trigger(char gate_id, uint32_t event_time, int16_t level) {
+  if (not packetSchedule(gate_id, event_time, level)) {
+    return false;
   }
-  digitalWrite(RADIO_TX, 0);
-  digitalWrite(RADIO_PDN, 0);
-  digitalWriteFast(LED_BUILTIN, 0);
 #if DEBUG == 0
   uint32_t now = millis();
   uint32_t elapsed = millis() - last_trigger_time;
   last_trigger_time = now;
-  println(elapsed);
+  Serial.println(elapsed);
 #endif
+  return true;
 }
 
 uint32_t next_update_time = millis();
 uint32_t debug_update_interval = 50;
 
 void debug_sensors(uint32_t report_delay) {
+  if (DEBUG == 2) {
+    telemetryUpdate();
+  }
   if (DEBUG == 1) {
     if (millis() - next_update_time > report_delay) {
       next_update_time += report_delay;
       // Serial.print(endSensor.slow.value(), 1);
-      Serial.print(endSensor.slow.value(), 1);
+      Serial.print(endSensor.slowLevel());
       Serial.print('\t');
-      Serial.print(endSensor.fast.value(), 1);
+      Serial.print(endSensor.fastLevel());
       if (gateID == 0) {
         Serial.print('\t');
-        Serial.print(sideSensor.slow.value(), 1);
+        Serial.print(sideSensor.slowLevel());
         Serial.print('\t');
-        Serial.print(sideSensor.fast.value(), 1);
+        Serial.print(sideSensor.fastLevel());
       }
       // force the serial plotter scale to stay constant
       Serial.print('\t');
@@ -283,76 +144,60 @@ void debug_sensors(uint32_t report_delay) {
 
 void setup() {
   pinMode(LED_BUILTIN, OUTPUT);
-  pinMode(RADIO_PDN, OUTPUT);
-  pinMode(RADIO_TX, OUTPUT);
-  pinMode(RADIO_DATA, OUTPUT);
   pinMode(GATE_ID_PIN0, INPUT_PULLUP);
   pinMode(GATE_ID_PIN1, INPUT_PULLUP);
   pinMode(GATE_ID_PIN2, INPUT_PULLUP);
   pinMode(GATE_ID_PIN3, INPUT_PULLUP);
-  digitalWrite(RADIO_PDN, 0);
-  digitalWrite(RADIO_TX, 0);
-  digitalWrite(RADIO_PDN, 0);
-  // digitalWrite(RADIO_TX, 1);
-  // digitalWrite(RADIO_PDN, 1);
+  txInit();
   Serial.begin(115200);
-  radio.begin(5000);
   gateID = digitalRead(GATE_ID_PIN0) << 3;
   gateID += digitalRead(+GATE_ID_PIN1) << 2;
   gateID += digitalRead(+GATE_ID_PIN2) << 1;
   gateID += digitalRead(GATE_ID_PIN3);
+  timestampInit();
   analogueInit();
-  systickInit();
 #if DEBUG == 0
   Serial.print(F("GATE ID: "));
   Serial.println(gateID);
-#else
+#elif DEBUG == 1
   Serial.println(F("END_SLOW, END_FAST, END_SLOW, END_FAST"));
 #endif
 
-  while (endSensor.mDiff < 1.0 and sideSensor.mDiff < 1.0) {
-    debug_sensors(debug_update_interval);
-    digitalWrite(LED_BUILTIN, 1);
-    delay(20);
-    digitalWrite(LED_BUILTIN, 0);
-    delay(50);
-  }
-  while (endSensor.mDiff > 1.0 or sideSensor.mDiff > 1.0) {
+  // the side sensor is only used on the start gate
+  bool side_ready = gateID != 0;
+  bool end_ready = false;
+  while (not(end_ready and side_ready)) {
     debug_sensors(debug_update_interval);
-    digitalWrite(LED_BUILTIN, 1);
-    delay(20);
-    digitalWrite(LED_BUILTIN, 0);
-    delay(50);
+    digitalWrite(LED_BUILTIN, (millis() >> 6) & 1);
+    end_ready = endSensor.calibrate();
+    side_ready = side_ready or sideSensor.calibrate();
   }
+  digitalWrite(LED_BUILTIN, 0);
+#if DEBUG == 0
+  Serial.print(F("ARMED AFTER "));
+  Serial.print(millis());
+  Serial.println(F("ms"));
+#endif
 
   // Serial.println(endSensor.fast.value());
   // Serial.println(sideSensor.fast.value());
   // Serial.println(F("RDY"));
   // Serial.println(F("0\t0\t0\t0\t0\t0\t"));
-  if (gateID == 0) { // the start and home gates
-    side_sensor_base = HOME_BASE;
-    end_sensor_base = START_BASE;
-  } else {
-    side_sensor_base = GOAL_BASE; // not used here
-    end_sensor_base = GOAL_BASE;
-  }
+  end_sensor_id = 'A' + gateID;
+  side_sensor_id = 'a' + gateID;
   next_update_time = millis() + debug_update_interval;
 }
 
 void loop() {
   debug_sensors(debug_update_interval);
-  if (endSensor.armed() && endSensor.mInterrupted) {
-    endSensor.disarm();
-    if (not endSensor.mMessageSent) {
-      send_trigger(end_sensor_base);
-      endSensor.mMessageSent = true;
-    }
-
-  } else if (sideSensor.armed() && sideSensor.mInterrupted) {
-    sideSensor.disarm();
-    if (not sideSensor.mMessageSent) {
-      send_trigger(side_sensor_base);
-      sideSensor.mMessageSent = true;
+  packetsUpdate();
+  TriggerEvent event;
+  while (triggers.peek(event)) {
+    char id = (event.sensor == END_GATE) ? end_sensor_id : side_sensor_id;
+    if (not send_trigger(id, event.time, event.level)) {
+      break;  // keep it until the scheduler can take it
     }
+    triggers.pop();
   }
-}
\ No newline at end of file
+  report_dropped_triggers();
+}
@@ -0,0 +1,323 @@
+#ifndef GATESENSOR_H
+#define GATESENSOR_H
+
+#include <Arduino.h>
+#include <util/atomic.h>
+#include "digitalWriteFast.h"
+#include "expfilter.h"
+#include "prefilter.h"
+
+/***
+ * A gate sensor watches one phototransistor and decides when the
+ * beam has been broken.
+ *
+ * Two filters follow the sensor reading. The slow filter has a time
+ * constant of one second and tracks the steady state illumination.
+ * The fast filter has a time constant of 2ms and follows the beam.
+ *
+ * The beam is interrupted when the fast value drops below the slow
+ * value by more than the trigger threshold and the sensor re-arms
+ * when the drop is back under a third of that.
+ *
+ * The threshold adapts to the noise on the sensor. A third filter
+ * tracks the mean absolute deviation of the fast value from the slow
+ * one, with a time constant of half a second, while the beam is not
+ * broken. The threshold is NOISE_FACTOR times that, which gives
+ * about the same false alarm rate in every venue, from a dim hall
+ * with a reading of 20 counts to a gate in sunlight near the top of
+ * the range. The threshold is never less than a quarter of the slow
+ * value, so a quiet gate does not trigger on a passing shadow, and
+ * never more than three quarters, which was the fixed ratio before.
+ * A quiet gate triggers much earlier in the fall of the fast filter
+ * than a noisy one.
+ *
+ * The sensor is updated from the sampling ISR so all the arithmetic
+ * is in integers. The filter outputs are brought to the fast filter
+ * format, Q(10.CMP_BITS), for the comparisons.
+ *
+ * update() returns true for the one sample on which the beam is seen
+ * to be broken. The event happened mEventAge before that sample. The
+ * caller is expected to record the event straight away since the
+ * sensor keeps no other record of it.
+ *
+ * The fast filter lags the sensor so the trigger always fires some
+ * time after the beam was actually cut. For a slow occlusion, which
+ * looks like a ramp, the lag is about one time constant. For an abrupt
+ * one, which looks like a step, it is up to ln(4) = 1.39 time constants
+ * before the filter falls to the threshold. A fixed group delay
+ * correction would leave a bias that depends on how fast the mouse is
+ * moving and on the threshold.
+ *
+ * Instead, the sensor keeps the last few raw readings. When the
+ * filter triggers, it walks back through them to find where the input
+ * itself fell through the threshold, interpolating between the
+ * readings either side of each crossing. mEventAge is how long ago
+ * that was, in microseconds, measured from the sample passed to
+ * update(). The history covers the worst case filter delay
+ * so the correction removes all of the filter lag, at any speed. If
+ * no crossing is found, the full history length is used.
+ *
+ * SAMPLE_HZ is the rate at which update() is called with a new
+ * reading. The filter constants are derived from it at compile time.
+ *
+ * The readings can be cleaned up by a Prefilter, see prefilter.h,
+ * before they reach the filters. The history then holds the cleaned
+ * readings and the delay of the prefilter is added to mEventAge.
+ *
+ * A new sensor does no detection until it has been calibrated. The
+ * ISR just collects blocks of CAL_SAMPLES readings, about 13ms worth,
+ * and calibrate(), called from the loop, finds the median and the
+ * median absolute deviation of each block. Once two blocks in a row
+ * agree, to within twice that deviation, and the gate is lit, the
+ * filters are seeded from them and the sensor is armed. The median
+ * is not upset by someone walking past during a block, the block
+ * just does not agree with the next one. That takes a few tens of
+ * milliseconds instead of waiting for the one second slow filter to
+ * settle.
+ */
+template <uint16_t SAMPLE_HZ, typename Prefilter = NoPrefilter>
+class GateSensor {
+ public:
+  static const uint8_t FAST_TAU_MS = 2;
+  typedef ExpFilter<SAMPLE_HZ, 1000, 12> SlowFilter;        // tau = 1.000 seconds
+  typedef ExpFilter<SAMPLE_HZ, FAST_TAU_MS, 6> FastFilter;  // tau = 0.002 seconds
+  // fed with the absolute deviation in quarter counts, up to 1023
+  typedef ExpFilter<SAMPLE_HZ, 500, 12> NoiseFilter;  // tau = 0.5 seconds
+  static const uint8_t CMP_BITS = FastFilter::FRAC_BITS;
+  static const uint8_t SLOW_SHIFT = SlowFilter::FRAC_BITS - CMP_BITS;
+  // one ADC count in comparison format
+  static const int32_t ONE_COUNT = (int32_t)1 << CMP_BITS;
+  // below this the gate is not lit
+  static const int16_t MIN_LIT_LEVEL = 10;
+  static const uint8_t CAL_SAMPLES = 64;
+  static const uint8_t NOISE_INPUT_SHIFT = CMP_BITS - 2;
+  static const uint8_t NOISE_SHIFT = NoiseFilter::FRAC_BITS + 2 - CMP_BITS;
+  // about 6.4 standard deviations for gaussian noise
+  static const uint8_t NOISE_FACTOR = 8;
+  static const uint8_t PREFILTER_DELAY = Prefilter::DELAY_SAMPLES;
+  // enough readings to cover the slowest filter response
+  static const uint8_t HISTORY_SIZE = 32;
+  static const uint8_t HISTORY_MASK = HISTORY_SIZE - 1;
+  static_assert(HISTORY_SIZE * 2000UL >= 3UL * SAMPLE_HZ * FAST_TAU_MS, "history too short for the fast filter delay");
+
+  explicit GateSensor(int pin) : mSensorPin(pin) {}
+
+  bool update(int16_t sample) {
+    mInput = sample;
+    sample = mPrefilter.update(sample);
+    if (not mCalibrated) {
+      if (mCalCount < CAL_SAMPLES) {
+        mCalibration[mCalCount++] = sample;
+      }
+      return false;
+    }
+    mHistory[++mNewest & HISTORY_MASK] = sample;
+    slow.update(sample);
+    fast.update(sample);
+    int32_t slowValue = slow.raw() >> SLOW_SHIFT;
+    int32_t fastValue = fast.raw();
+    // When sensor is occluded, light the LED. It stays on until triggered
+    if (slowValue < MIN_LIT_LEVEL * ONE_COUNT) {
+      digitalWriteFast(LED_BUILTIN, 1);
+      return false;
+    }
+    // fast recovery after lengthy occlusion
+    if (fastValue > slowValue) {
+      slow.set_raw(fastValue << SLOW_SHIFT);
+      slowValue = fastValue;
+    }
+    // mDiff just lets us know when the sensor is properly lit
+    mDiff = (uint16_t)(slowValue - fastValue);
+    // now do the actual detection with plenty of hysteresis
+    int32_t drop = slowValue - fastValue;
+    int32_t trigger = triggerDrop(slowValue);
+    bool broken = false;
+    if (drop > trigger) {
+      broken = not mInterrupted;
+      mInterrupted = true;
+      if (broken) {
+        mEventAge = crossingAge(slowValue - trigger);
+      }
+    }
+    if (3 * drop < trigger) {
+      mInterrupted = false;
+    }
+    if (not mInterrupted) {
+      int32_t deviation = (drop < 0 ? -drop : drop) >> NOISE_INPUT_SHIFT;
+      noise.update(deviation > 1023 ? 1023 : (int16_t)deviation);
+    }
+    mTrigger = trigger;
+    return broken;
+  }
+
+  /***
+   * Call from the loop until it returns true. Each time a block of
+   * readings is complete, it is checked against the last one. If the
+   * two do not agree, another block is collected.
+   */
+  bool calibrate() {
+    if (mCalibrated) {
+      return true;
+    }
+    if (mCalCount < CAL_SAMPLES) {
+      return false;
+    }
+    // the ISR leaves the block alone until mCalCount is cleared
+    int16_t median = blockMedian();
+    for (uint8_t i = 0; i < CAL_SAMPLES; i++) {
+      mCalibration[i] = abs(mCalibration[i] - median);
+    }
+    int16_t deviation = blockMedian();
+    bool stable = median >= MIN_LIT_LEVEL && mCalMedian >= 0 && abs(median - mCalMedian) <= 2 * deviation + 1;
+    mCalMedian = median;
+    if (not stable) {
+      mCalCount = 0;
+      return false;
+    }
+    /***
+     * The noise filter tracks the mean absolute deviation of the fast
+     * filter. For gaussian noise that is 1.18 times the median absolute
+     * deviation of the readings, reduced by the fast filter by a factor
+     * of sqrt(alpha/(2-alpha)).
+     */
+    float fastGain = sqrt(1.0 / (2.0 * SAMPLE_HZ * FAST_TAU_MS / 1000.0 - 1.0));
+    int32_t noiseSeed = (int32_t)(4.0 * 1.18 * fastGain * deviation * NoiseFilter::ONE);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      slow.set_value(median);
+      fast.set_value(median);
+      noise.set_raw(noiseSeed);
+      for (uint8_t i = 0; i < HISTORY_SIZE; i++) {
+        mHistory[i] = median;
+      }
+      mInterrupted = false;
+      mCalibrated = true;
+    }
+    return true;
+  }
+
+  bool calibrated() { return mCalibrated; }
+
+  /***
+   * How far the fast value must drop below the slow value to count as
+   * a break, in comparison format.
+   */
+  int32_t triggerDrop(int32_t slowValue) const {
+    int32_t trigger = (noise.raw() >> NOISE_SHIFT) * NOISE_FACTOR;
+    int32_t lowest = slowValue / 4;
+    int32_t highest = slowValue - lowest;
+    if (trigger < lowest) {
+      return lowest;
+    }
+    if (trigger > highest) {
+      return highest;
+    }
+    return trigger;
+  }
+
+  /***
+   * Find how long ago the input fell through the threshold, which is
+   * given in comparison format. The fraction of a sample period is
+   * kept as Q8 so the result is to better than a microsecond.
+   *
+   * On a slow ramp the noise can take the input back and forth across
+   * the threshold a few times. The newest crossing is late and the
+   * oldest is early by about the same amount, so the event is put
+   * half way between them.
+   */
+  uint16_t crossingAge(int32_t threshold) {
+    uint16_t newest = 0;  // in Q8 sample periods, 0 until one is found
+    uint16_t oldest = 0;
+    int32_t below = (int32_t)mHistory[mNewest & HISTORY_MASK] << CMP_BITS;
+    for (uint8_t age = 1; age < HISTORY_SIZE; age++) {
+      int32_t above = (int32_t)mHistory[(mNewest - age) & HISTORY_MASK] << CMP_BITS;
+      if (above >= threshold && below < threshold) {
+        // the crossing is this fraction of a sample after the 'above' reading
+        uint16_t fraction = (uint16_t)(((above - threshold) << 8) / (above - below));
+        oldest = age * 256 - fraction;
+        if (newest == 0) {
+          newest = oldest;
+        }
+      }
+      below = above;
+    }
+    if (newest == 0) {
+      return (uint32_t)(HISTORY_SIZE + PREFILTER_DELAY) * 1000000UL / SAMPLE_HZ;
+    }
+    return (uint32_t)((newest + oldest) / 2 + PREFILTER_DELAY * 256) * 15625 / (4UL * SAMPLE_HZ);
+  }
+
+  /***
+   * These are for use outside the ISR. The values are more than one
+   * byte wide so they must be read with interrupts disabled.
+   */
+  int16_t slowLevel() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      return slow.value();
+    }
+    return 0;
+  }
+
+  int16_t fastLevel() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      return fast.value();
+    }
+    return 0;
+  }
+
+  // the drop below the slow level that will trigger, in ADC counts
+  int16_t triggerLevel() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      return (int16_t)((mTrigger + ONE_COUNT / 2) >> CMP_BITS);
+    }
+    return 0;
+  }
+
+  // mean absolute deviation of the fast filter, in ADC counts
+  int16_t noiseLevel() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      return (int16_t)((noise.raw() + ((int32_t)1 << (NoiseFilter::FRAC_BITS + 1))) >> (NoiseFilter::FRAC_BITS + 2));
+    }
+    return 0;
+  }
+
+  // difference between slow and fast filters in Q(10.CMP_BITS) format
+  uint16_t difference() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      return mDiff;
+    }
+    return 0;
+  }
+
+  // sorts the calibration block
+  int16_t blockMedian() {
+    for (uint8_t i = 1; i < CAL_SAMPLES; i++) {
+      int16_t value = mCalibration[i];
+      uint8_t j = i;
+      while (j > 0 && mCalibration[j - 1] > value) {
+        mCalibration[j] = mCalibration[j - 1];
+        j--;
+      }
+      mCalibration[j] = value;
+    }
+    return mCalibration[CAL_SAMPLES / 2];
+  }
+
+  int mSensorPin;
+  volatile int16_t mInput = 0;
+  volatile uint16_t mDiff = 0;
+  volatile int32_t mTrigger = 0;
+  volatile uint16_t mEventAge = 0;
+  int16_t mHistory[HISTORY_SIZE] = {0};
+  uint8_t mNewest = 0;
+  Prefilter mPrefilter;
+  SlowFilter slow;
+  FastFilter fast;
+  NoiseFilter noise;
+  volatile bool mInterrupted = false;
+  volatile bool mCalibrated = false;
+  volatile uint8_t mCalCount = 0;
+  int16_t mCalibration[CAL_SAMPLES];
+  int16_t mCalMedian = -1;
+};
+
+#endif
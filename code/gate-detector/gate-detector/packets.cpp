@@ -0,0 +1,116 @@
+#include "packets.h"
+#include "timestamp.h"
+#include "transmitter.h"
+
+struct Report {
+  char gate;  // zero when the slot is free
+  uint8_t sequence;  // of the next packet to send
+  int16_t level;
+  uint32_t eventTime;
+  uint32_t firstStart;  // start bit of packet zero
+};
+
+const uint8_t MAX_REPORTS = 2;
+// allowance for building a packet before handing it to an idle transmitter
+const uint16_t PACKET_BUILD_TIME = 200;  // microseconds
+static Report sReports[MAX_REPORTS];
+
+static void putDigits(char *p, uint16_t value, uint8_t digits) {
+  while (digits--) {
+    p[digits] = '0' + value % 10;
+    value /= 10;
+  }
+}
+
+/***
+ * The check character folds the XOR of G through DDDD down to four
+ * bits so that every bit of every character has some effect.
+ */
+static char checkCharacter(const char *p, uint8_t count) {
+  uint8_t x = 0;
+  while (count--) {
+    x ^= *p++;
+  }
+  return 'a' + ((x ^ (x >> 4)) & 0x0F);
+}
+
+static void makePacket(char *packet, const Report &report, uint32_t delay) {
+  int16_t level = constrain(report.level, 0, (int16_t)MAX_PACKET_LEVEL);
+  delay = (delay + 5) / 10;
+  if (delay > MAX_PACKET_DELAY) {
+    delay = MAX_PACKET_DELAY;
+  }
+  packet[0] = '*';
+  packet[1] = report.gate;
+  packet[2] = '0' + report.sequence;
+  putDigits(packet + 3, level, 3);
+  putDigits(packet + 6, delay, 4);
+  packet[10] = checkCharacter(packet + 1, 9);
+  packet[11] = '#';
+  packet[12] = 0;
+}
+
+bool packetSchedule(char gate, uint32_t eventTime, int16_t level) {
+  Report *slot = NULL;
+  for (uint8_t i = 0; i < MAX_REPORTS; i++) {
+    if (sReports[i].gate == gate) {
+      slot = &sReports[i];
+      break;
+    }
+    if (sReports[i].gate == 0 && slot == NULL) {
+      slot = &sReports[i];
+    }
+  }
+  if (slot == NULL || (slot->gate != 0 && slot->sequence == 0)) {
+    return false;
+  }
+  slot->gate = gate;
+  slot->sequence = 0;
+  slot->level = level;
+  slot->eventTime = eventTime;
+  return true;
+}
+
+/***
+ * A repeat is queued behind whatever the transmitter is busy with
+ * only if that will not finish before the repeat is due. Otherwise it
+ * waits for the transmitter to go idle and is then queued to start
+ * exactly when it is due, or as soon as possible if that is too close.
+ * Either way the start time is known before the packet is built.
+ */
+void packetsUpdate() {
+  for (uint8_t i = 0; i < MAX_REPORTS; i++) {
+    Report &report = sReports[i];
+    if (report.gate == 0) {
+      continue;
+    }
+    uint32_t offset = report.sequence * PACKET_REPEAT_INTERVAL;
+    uint32_t start = txStartTime();
+    if (report.sequence > 0) {
+      uint32_t due = report.firstStart + offset;
+      if (txBusy()) {
+        if ((int32_t)(due - start) > 0) {
+          continue;  // wait for the transmitter to go idle
+        }
+      } else {
+        uint32_t now = timestamp();
+        if ((int32_t)(due - now) > (int32_t)TX_LEAD_TIME) {
+          continue;  // not yet
+        }
+        uint32_t earliest = now + RADIO_WAKEUP_TIME + PACKET_BUILD_TIME;
+        start = (int32_t)(due - earliest) > 0 ? due : earliest;
+      }
+    }
+    char packet[PACKET_SIZE];
+    makePacket(packet, report, start - offset - report.eventTime);
+    if (not txSend(packet, start)) {
+      continue;  // try again next time
+    }
+    if (report.sequence == 0) {
+      report.firstStart = start;
+    }
+    if (++report.sequence >= PACKET_REPEATS) {
+      report.gate = 0;
+    }
+  }
+}
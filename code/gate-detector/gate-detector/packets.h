@@ -0,0 +1,41 @@
+#ifndef PACKETS_H
+#define PACKETS_H
+
+#include <Arduino.h>
+
+/***
+ * Event packets, as described in protocol.md:
+ *
+ *   *GNSSSDDDDC#
+ *
+ * Every event is reported PACKET_REPEATS times. The first packet goes
+ * out as soon as the transmitter can take it and the repeats follow
+ * at exact PACKET_REPEAT_INTERVAL steps from the start of that first
+ * packet. If the transmitter is still busy with something else when
+ * a repeat is due, that repeat starts late and the DDDD field of the
+ * packet says by how much, so every packet on its own gives the
+ * receiver the exact event time.
+ *
+ * packetSchedule() just records the event. The packets are built and
+ * handed to the transmitter by packetsUpdate() which never waits and
+ * must be called from loop() at least once every millisecond or so
+ * for the repeats to be sent on time.
+ *
+ * Each sensor has its own slot, identified by its gate character, so
+ * both sensors can be reporting at the same time. A new event from a
+ * sensor that is still repeating the last one replaces it but only
+ * once the first packet of the last one has gone. Until then,
+ * packetSchedule() returns false and the caller should keep the event
+ * and try again.
+ */
+
+const uint8_t PACKET_REPEATS = 10;
+const uint32_t PACKET_REPEAT_INTERVAL = 50000;  // microseconds
+const uint8_t PACKET_SIZE = 13;                 // including the terminating null
+const uint16_t MAX_PACKET_DELAY = 9999;         // in units of 10us
+const uint16_t MAX_PACKET_LEVEL = 999;
+
+bool packetSchedule(char gate, uint32_t eventTime, int16_t level);
+void packetsUpdate();
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef PINS_H
+#define PINS_H
+
+#include <Arduino.h>
+
+/// Pin Assignments
+const int sideSensorPin = A0;
+const int endSensorPin = A1;
+
+const int RADIO_DATA = 4;
+const int RADIO_PDN = 2;
+const int RADIO_TX = 3;
+
+#define GATE_ID_PIN0 9
+#define GATE_ID_PIN1 8
+#define GATE_ID_PIN2 7
+#define GATE_ID_PIN3 6
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <Arduino.h>
+
+/***
+ * Impulse rejection for the raw sensor readings.
+ *
+ * Robots flash their emitters at 1kHz or more and the pulses can be
+ * very bright. Camera flashes are brighter still and last about a
+ * millisecond. Either one can upset the gate detector. A bright pulse
+ * pulls the fast filter up and the fast recovery logic drags the slow
+ * filter up with it. When the pulse ends, the fast filter drops back
+ * to the normal level which can now look like a broken beam.
+ *
+ * A prefilter sits in front of the GateSensor filters and cleans up
+ * the readings before they get there. It is chosen with a template
+ * parameter so the compiler can inline it into the sampling ISR.
+ *
+ * A prefilter has an update() method that takes a raw reading and
+ * returns the cleaned one. It also has DELAY_SAMPLES, the number of
+ * samples by which it delays a falling edge - a broken beam. The gate
+ * sensor adds that to the age of an event so the event time is not
+ * affected.
+ *
+ *  NoPrefilter         passes the readings straight through
+ *  MedianPrefilter<N>  running median of 3 or 5 readings. Removes any
+ *                      spike, bright or dark, up to N/2 samples long
+ *                      and delays every edge by N/2 samples.
+ *  BrightBlanker<N>    holds the last good reading while the input is
+ *                      more than 50% above it, for up to N samples.
+ *                      A real increase in light gets through after
+ *                      that. Falling edges are not delayed at all.
+ *  PrefilterChain<A,B> runs A and then B.
+ *
+ * Each sensor is sampled every 208us so a median of 3 removes single
+ * sample robot pulses for the cost of a few comparisons. A blanker
+ * of 8 samples covers a camera flash.
+ */
+
+struct NoPrefilter {
+  static const uint8_t DELAY_SAMPLES = 0;
+
+  int16_t update(int16_t sample) { return sample; }
+};
+
+template <uint8_t N>
+class MedianPrefilter {
+ public:
+  static_assert(N == 3 || N == 5, "only 3 and 5 sample medians are provided");
+  static const uint8_t DELAY_SAMPLES = N / 2;
+
+  int16_t update(int16_t sample) {
+    mWindow[mIndex] = sample;
+    if (++mIndex >= N) {
+      mIndex = 0;
+    }
+    return median();
+  }
+
+ private:
+  static void sort(int16_t &a, int16_t &b) {
+    if (a > b) {
+      int16_t t = a;
+      a = b;
+      b = t;
+    }
+  }
+
+  int16_t median() const {
+    int16_t p0 = mWindow[0];
+    int16_t p1 = mWindow[1];
+    int16_t p2 = mWindow[2];
+    if (N == 3) {
+      sort(p0, p1);
+      sort(p1, p2);
+      sort(p0, p1);
+      return p1;
+    }
+    // the smallest sorting network that finds the middle of five
+    int16_t p3 = mWindow[N > 3 ? 3 : 0];
+    int16_t p4 = mWindow[N > 4 ? 4 : 0];
+    sort(p0, p1);
+    sort(p3, p4);
+    sort(p0, p3);
+    sort(p1, p4);
+    sort(p1, p2);
+    sort(p2, p3);
+    sort(p1, p2);
+    return p2;
+  }
+
+  int16_t mWindow[N] = {0};
+  uint8_t mIndex = 0;
+};
+
+template <uint8_t N>
+class BrightBlanker {
+ public:
+  static const uint8_t DELAY_SAMPLES = 0;
+
+  int16_t update(int16_t sample) {
+    if (mHeld >= 0 && mCount < N && sample > mHeld + mHeld / 2 + 4) {
+      mCount++;
+      return mHeld;
+    }
+    mCount = 0;
+    mHeld = sample;
+    return sample;
+  }
+
+ private:
+  int16_t mHeld = -1;
+  uint8_t mCount = 0;
+};
+
+template <typename A, typename B>
+class PrefilterChain {
+ public:
+  static const uint8_t DELAY_SAMPLES = A::DELAY_SAMPLES + B::DELAY_SAMPLES;
+
+  int16_t update(int16_t sample) { return mSecond.update(mFirst.update(sample)); }
+
+ private:
+  A mFirst;
+  B mSecond;
+};
+
+#endif
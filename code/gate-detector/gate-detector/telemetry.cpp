@@ -0,0 +1,154 @@
+#include "telemetry.h"
+
+/***
+ * Ring buffer entries are either a reading, with the channel in the
+ * top bit, or a gap marker holding the number of readings dropped
+ * just before the next entry.
+ */
+const uint16_t ENTRY_CHANNEL = 0x8000;
+const uint16_t ENTRY_GAP = 0x4000;
+const uint16_t ENTRY_VALUE = 0x03FF;
+const uint16_t MAX_GAP = 0x3FFF;
+const uint8_t RING_MASK = TELEMETRY_RING_SIZE - 1;
+static_assert((TELEMETRY_RING_SIZE & RING_MASK) == 0 && TELEMETRY_RING_SIZE <= 128, "ring size must be a power of two up to 128");
+
+const uint8_t NIBBLE_ESCAPE = 0x8;
+const uint8_t HEADER_SIZE = 9;
+const uint8_t MAX_PAYLOAD = TELEMETRY_FRAME_SAMPLES * 4 / 2;
+const uint8_t MAX_FRAME = HEADER_SIZE + MAX_PAYLOAD + 1;
+
+static volatile uint16_t sRing[TELEMETRY_RING_SIZE];
+static volatile uint8_t sHead;  // written only by the ISR
+static volatile uint8_t sTail;  // written only by the loop
+static volatile uint16_t sLost;
+
+static uint8_t sFrame[MAX_FRAME];
+static uint8_t sFrameLength;
+static uint8_t sFrameSent;
+static uint8_t sSequence;
+static uint32_t sCounter;  // number of the next sample to be encoded
+
+// called from the sampling ISR
+void telemetrySample(uint8_t channel, int16_t value) {
+  uint8_t head = sHead;
+  uint8_t space = TELEMETRY_RING_SIZE - (uint8_t)(head - sTail);
+  if (sLost) {
+    if (space < 2) {
+      if (sLost < MAX_GAP) {
+        sLost++;
+      }
+      return;
+    }
+    sRing[head++ & RING_MASK] = ENTRY_GAP | sLost;
+    sLost = 0;
+  } else if (space == 0) {
+    sLost = 1;
+    return;
+  }
+  sRing[head++ & RING_MASK] = (channel ? ENTRY_CHANNEL : 0) | ((uint16_t)value & ENTRY_VALUE);
+  sHead = head;
+}
+
+static uint8_t crc8(const uint8_t *data, uint8_t length) {
+  uint8_t crc = 0;
+  while (length--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint8_t *sNibbleByte;
+static bool sHighNibble;
+
+static void putNibble(uint8_t nibble) {
+  if (sHighNibble) {
+    *sNibbleByte++ |= nibble << 4;
+  } else {
+    *sNibbleByte = nibble & 0x0F;
+  }
+  sHighNibble = not sHighNibble;
+}
+
+/***
+ * Take up to one frame of readings from the ring. A frame always ends
+ * at a gap so that the counter in the next frame can say where the
+ * readings start again.
+ */
+static bool buildFrame() {
+  uint8_t tail = sTail;
+  uint8_t available = (uint8_t)(sHead - tail);
+  // skip any gap markers at the front
+  while (available > 0 && (sRing[tail & RING_MASK] & ENTRY_GAP)) {
+    sCounter += sRing[tail & RING_MASK] & MAX_GAP;
+    tail++;
+    available--;
+    sTail = tail;
+  }
+  if (available < TELEMETRY_FRAME_SAMPLES) {
+    return false;
+  }
+  int16_t last[2] = {-1, -1};
+  uint8_t firstChannel = (sRing[tail & RING_MASK] & ENTRY_CHANNEL) ? 1 : 0;
+  uint8_t count = 0;
+  sNibbleByte = sFrame + HEADER_SIZE;
+  sHighNibble = false;
+  while (count < TELEMETRY_FRAME_SAMPLES) {
+    uint16_t entry = sRing[tail & RING_MASK];
+    uint8_t channel = (entry & ENTRY_CHANNEL) ? 1 : 0;
+    if ((entry & ENTRY_GAP) || channel != ((firstChannel + count) & 1)) {
+      break;
+    }
+    int16_t value = entry & ENTRY_VALUE;
+    int16_t delta = value - last[channel];
+    if (last[channel] >= 0 && delta >= -7 && delta <= 7) {
+      putNibble((uint8_t)delta);
+    } else {
+      putNibble(NIBBLE_ESCAPE);
+      putNibble(value);
+      putNibble(value >> 4);
+      putNibble(value >> 8);
+    }
+    last[channel] = value;
+    tail++;
+    count++;
+  }
+  sTail = tail;
+  if (sHighNibble) {
+    sNibbleByte++;
+  }
+  uint8_t payload = sNibbleByte - (sFrame + HEADER_SIZE);
+  sFrame[0] = TELEMETRY_SYNC0;
+  sFrame[1] = TELEMETRY_SYNC1;
+  sFrame[2] = payload;
+  sFrame[3] = sSequence++;
+  sFrame[4] = (uint8_t)sCounter;
+  sFrame[5] = (uint8_t)(sCounter >> 8);
+  sFrame[6] = (uint8_t)(sCounter >> 16);
+  sFrame[7] = (uint8_t)(sCounter >> 24);
+  sFrame[8] = count | (firstChannel << 7);
+  sFrame[HEADER_SIZE + payload] = crc8(sFrame + 2, HEADER_SIZE - 2 + payload);
+  sFrameLength = HEADER_SIZE + payload + 1;
+  sFrameSent = 0;
+  sCounter += count;
+  return true;
+}
+
+/***
+ * Call as often as possible from loop(). Never waits for the
+ * serial port.
+ */
+void telemetryUpdate() {
+  if (sFrameSent == sFrameLength && not buildFrame()) {
+    return;
+  }
+  int space = Serial.availableForWrite();
+  uint8_t remaining = sFrameLength - sFrameSent;
+  uint8_t count = (space < remaining) ? space : remaining;
+  if (count > 0) {
+    Serial.write(sFrame + sFrameSent, count);
+    sFrameSent += count;
+  }
+}
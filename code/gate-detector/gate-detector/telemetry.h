@@ -0,0 +1,54 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+
+/***
+ * Raw sensor telemetry.
+ *
+ * With DEBUG set to 2, every ADC reading from both sensor channels is
+ * sent over the serial port in a compact binary form so that false
+ * triggers can be examined sample by sample on a host computer. The
+ * telemetry-decoder project turns a capture into a CSV file.
+ *
+ * The sampling ISR only copies each reading into a ring buffer with
+ * telemetrySample(). All the encoding is done in the loop by
+ * telemetryUpdate() which writes no more than Serial.availableForWrite()
+ * allows so it never waits and never holds up the sensors. If the loop
+ * or the serial link cannot keep up, the ring buffer fills and readings
+ * are dropped. The ISR counts them and the count goes into the stream
+ * so the decoder knows exactly how many samples are missing and where.
+ *
+ * There are 9615 readings a second, 104us apart. At 115200 baud that
+ * leaves about ten bits for each one so they are sent as differences,
+ * which are mostly small. Each frame is
+ *
+ *   0xA5 0x5A    sync
+ *   length       payload bytes
+ *   sequence     frame number, modulo 256
+ *   counter      4 bytes, little endian. The number of the first sample
+ *                in the frame, counting every reading since startup
+ *                including any that were dropped.
+ *   info         bits 0-6 the number of samples in the frame, bit 7 the
+ *                channel of the first one. The channels alternate.
+ *   payload      one nibble per sample, low nibble first. Each is the
+ *                change from the last reading of the same channel, -7 to
+ *                +7. A nibble of 8 is followed by three more that hold
+ *                the 10 bit reading itself, low nibble first. The first
+ *                reading of each channel in a frame is always sent that
+ *                way so every frame can be decoded on its own.
+ *   crc          CRC-8, polynomial 0x07, of length to the end of payload
+ *
+ * Typical frames use well under half the link so there is room for
+ * noisy signals before any samples are lost.
+ */
+
+const uint8_t TELEMETRY_SYNC0 = 0xA5;
+const uint8_t TELEMETRY_SYNC1 = 0x5A;
+const uint8_t TELEMETRY_FRAME_SAMPLES = 64;
+const uint8_t TELEMETRY_RING_SIZE = 128;
+
+void telemetrySample(uint8_t channel, int16_t value);
+void telemetryUpdate();
+
+#endif
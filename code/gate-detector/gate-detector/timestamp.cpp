@@ -0,0 +1,32 @@
+#include "timestamp.h"
+
+static volatile uint16_t sOverflows;
+
+void timestampInit() {
+  // normal mode, count from 0 to 0xFFFF
+  TCCR1A = 0;
+  // divisor = 8 => timer clock = 1MHz
+  TCCR1B = _BV(CS11);
+  TCNT1 = 0;
+  sOverflows = 0;
+  bitSet(TIFR1, TOV1);   // clear any pending overflow
+  bitSet(TIMSK1, TOIE1); // enable the overflow interrupt
+}
+
+ISR(TIMER1_OVF_vect) {
+  sOverflows++;
+}
+
+uint32_t timestamp() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t count = TCNT1;
+  uint16_t overflows = sOverflows;
+  // An overflow may be pending if interrupts were already disabled.
+  // If the count is small, it happened before TCNT1 was read.
+  if (bit_is_set(TIFR1, TOV1) && count < 0x8000) {
+    overflows++;
+  }
+  SREG = oldSREG;
+  return ((uint32_t)overflows << 16) | count;
+}
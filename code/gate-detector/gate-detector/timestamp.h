@@ -0,0 +1,27 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <Arduino.h>
+
+/***
+ * Free-running microsecond clock.
+ *
+ * Timer 1 counts at F_CPU/8, which is 1MHz on the 8MHz gate detector,
+ * and the overflow interrupt extends the count to 32 bits. The count
+ * wraps after about 71 minutes so only differences between timestamps
+ * are meaningful.
+ *
+ * millis() and micros() are not good enough for event times. micros()
+ * only has a resolution of 8us at 8MHz and both depend on the Timer 0
+ * interrupt which can be held off.
+ *
+ * timestamp() may be called with interrupts enabled or from inside
+ * an ISR.
+ */
+
+static_assert(F_CPU == 8000000L, "the timestamp clock expects an 8MHz processor");
+
+void timestampInit();
+uint32_t timestamp();
+
+#endif
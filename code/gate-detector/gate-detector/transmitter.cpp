@@ -0,0 +1,148 @@
+#include "transmitter.h"
+#include <util/atomic.h>
+#include "digitalWriteFast.h"
+#include "pins.h"
+#include "timestamp.h"
+
+// sBitIndex values outside the frame
+const uint8_t FRAME_DONE = 10;
+const uint8_t POWER_UP = 11;
+
+static volatile uint8_t sBuffer[TX_BUFFER_SIZE];
+static volatile uint8_t sHead;  // next free slot
+static volatile uint8_t sTail;  // next character to send
+static volatile bool sActive;
+static volatile uint8_t sBitIndex;  // bit to be sent at sNextEdge
+static volatile uint32_t sNextEdge;
+static uint8_t sCharacter;
+
+static uint8_t queued() {
+  return (uint8_t)(sHead - sTail) % TX_BUFFER_SIZE;
+}
+
+static void radioOn() {
+  digitalWriteFast(LED_BUILTIN, 1);
+  // carrier on as soon as the transmitter wakes
+  digitalWriteFast(RADIO_DATA, 1);
+  digitalWriteFast(RADIO_PDN, 1);
+  digitalWriteFast(RADIO_TX, 1);
+}
+
+static void radioOff() {
+  digitalWriteFast(RADIO_TX, 0);
+  digitalWriteFast(RADIO_PDN, 0);
+  digitalWriteFast(LED_BUILTIN, 0);
+}
+
+void txInit() {
+  pinMode(RADIO_PDN, OUTPUT);
+  pinMode(RADIO_TX, OUTPUT);
+  pinMode(RADIO_DATA, OUTPUT);
+  radioOff();
+  sHead = 0;
+  sTail = 0;
+  sActive = false;
+}
+
+bool txBusy() {
+  return sActive;
+}
+
+/***
+ * Must be called with interrupts disabled.
+ */
+static uint32_t nextStart() {
+  uint32_t start;
+  if (not sActive) {
+    return timestamp() + TX_LEAD_TIME;
+  }
+  if (sBitIndex == POWER_UP) {
+    start = sNextEdge + RADIO_WAKEUP_TIME;
+  } else {
+    start = sNextEdge + (uint32_t)(FRAME_DONE - sBitIndex) * TX_BIT_TIME;
+  }
+  return start + (uint32_t)queued() * TX_CHAR_TIME;
+}
+
+// the timestamp of the start bit of whatever is sent next
+uint32_t txStartTime() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    return nextStart();
+  }
+  return 0;
+}
+
+bool txSend(const char *s, uint32_t start) {
+  uint8_t length = strlen(s);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (length >= TX_BUFFER_SIZE - queued()) {
+      return false;
+    }
+    if (not sActive) {
+      // there must be time to set up the first compare and it
+      // must be within reach of the 16 bit compare register
+      int32_t lead = (int32_t)(start - RADIO_WAKEUP_TIME - timestamp());
+      if (lead < 20 || lead > 60000) {
+        return false;
+      }
+    } else if (nextStart() != start) {
+      return false;
+    }
+    for (uint8_t i = 0; i < length; i++) {
+      sBuffer[sHead] = s[i];
+      sHead = (sHead + 1) % TX_BUFFER_SIZE;
+    }
+    if (not sActive) {
+      sActive = true;
+      sBitIndex = POWER_UP;
+      sNextEdge = start - RADIO_WAKEUP_TIME;
+      OCR1B = (uint16_t)sNextEdge;
+      bitSet(TIFR1, OCF1B);    // clear any old match
+      bitSet(TIMSK1, OCIE1B);  // enable the bit clock
+    }
+  }
+  return true;
+}
+
+/***
+ * Runs at every bit edge. The line level is set first so that
+ * the edge is as close as possible to the compare time.
+ */
+ISR(TIMER1_COMPB_vect) {
+  uint16_t interval = TX_BIT_TIME;
+  uint8_t index = sBitIndex;
+  if (index == POWER_UP) {
+    radioOn();
+    interval = RADIO_WAKEUP_TIME;
+    index = FRAME_DONE;
+  } else {
+    if (index == FRAME_DONE) {
+      if (sHead == sTail) {
+        // last stop bit is complete
+        bitClear(TIMSK1, OCIE1B);
+        radioOff();
+        sActive = false;
+        return;
+      }
+      sCharacter = sBuffer[sTail];
+      sTail = (sTail + 1) % TX_BUFFER_SIZE;
+      index = 0;
+    }
+    if (index == 0) {
+      digitalWriteFast(RADIO_DATA, 0);  // start bit
+    } else if (index == 9) {
+      digitalWriteFast(RADIO_DATA, 1);  // stop bit
+    } else {
+      if (sCharacter & 1) {
+        digitalWriteFast(RADIO_DATA, 1);
+      } else {
+        digitalWriteFast(RADIO_DATA, 0);
+      }
+      sCharacter >>= 1;
+    }
+    index++;
+  }
+  sBitIndex = index;
+  sNextEdge += interval;
+  OCR1B += interval;
+}
@@ -0,0 +1,48 @@
+#ifndef TRANSMITTER_H
+#define TRANSMITTER_H
+
+#include <Arduino.h>
+
+/***
+ * Interrupt driven radio transmitter.
+ *
+ * Characters are sent as 10 bit frames - start bit, eight data bits
+ * LSB first, stop bit - at 5000 baud. The bits are clocked out by
+ * the compare B interrupt of Timer 1, the same free-running 1MHz
+ * counter that provides timestamp(), so every bit edge falls on an
+ * exact, known timestamp. Interrupts are never disabled for more than
+ * a few microseconds and the sensors keep sampling throughout.
+ *
+ * Strings are placed in a queue and sent back to back with no gaps.
+ * When the transmitter is idle, it is powered up RADIO_WAKEUP_TIME
+ * before the first bit and it is powered down again after the last
+ * stop bit once the queue is empty.
+ *
+ * Because the bit timing is exact, the time at which a string will
+ * start can be known before it is queued. txStartTime() gives that
+ * time for whatever is sent next. txSend() only accepts the string
+ * if it would still start at that time. If it would not, because
+ * the transmitter went idle in the meantime for example, it returns
+ * false and the caller should build the string again with a new
+ * start time.
+ *
+ * When the transmitter is idle, any start time that leaves room for
+ * the radio to wake up is accepted, up to about 60ms ahead. That lets
+ * a string be sent at a chosen time.
+ */
+
+const uint16_t TX_BAUD = 5000;
+const uint16_t TX_BIT_TIME = 1000000UL / TX_BAUD;  // microseconds
+const uint16_t TX_CHAR_TIME = 10 * TX_BIT_TIME;
+// allow the transmitter to stabilise before sending
+const uint16_t RADIO_WAKEUP_TIME = 500;  // microseconds
+// time allowed to build a string before it is sent from idle
+const uint16_t TX_LEAD_TIME = 2000;  // microseconds
+const uint8_t TX_BUFFER_SIZE = 64;
+
+void txInit();
+uint32_t txStartTime();
+bool txSend(const char *s, uint32_t start);
+bool txBusy();
+
+#endif
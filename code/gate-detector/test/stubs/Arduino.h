@@ -0,0 +1,40 @@
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+/***
+ * Just enough of the Arduino core for the detector sensor templates to
+ * build on the host in [env:native].
+ *
+ * The tests feed readings to the sensors directly so there are no
+ * registers here. digitalWrite() records the last value written to
+ * LED_BUILTIN in stubLed.
+ *
+ * Nothing here is used by the firmware build.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000L
+#endif
+
+enum { LOW = 0, HIGH = 1, INPUT = 0, OUTPUT = 1, INPUT_PULLUP = 2 };
+enum { A0 = 14, A1, A2, A3, A4, A5, A6, A7 };
+const uint8_t LED_BUILTIN = 13;
+
+inline uint8_t stubLed;
+
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin == LED_BUILTIN) {
+    stubLed = value;
+  }
+}
+inline int digitalRead(uint8_t pin) {
+  return HIGH;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef ATOMIC_STUB_H
+#define ATOMIC_STUB_H
+
+/***
+ * The host has no interrupts so an atomic block just runs its body
+ * once.
+ */
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (uint8_t _done = (type); not _done; _done = 1)
+
+#endif
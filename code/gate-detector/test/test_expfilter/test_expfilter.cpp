@@ -0,0 +1,348 @@
+/***
+ * The integer ExpFilter against the floating point filter it replaced.
+ *
+ * The float filter is the one the detector used to run in the ISR,
+ *
+ *   value += alpha * (input - value), alpha = 1/(F*tau)
+ *
+ * in single precision, as on the AVR. It is built on a float that
+ * counts the soft-float calls it would have made so the cost of the
+ * old code can be reported per sample.
+ *
+ * The traces are synthetic: a lit gate with noise, steps, slow fades
+ * and mice of different speeds, at light levels from a dim hall to
+ * near the top of the ADC range. A trace recorded with the telemetry
+ * decoder can be replayed as well by setting GATE_TRACE to the CSV
+ * file before running the tests.
+ *
+ * The soft-float calls are turned into cycles with approximate costs
+ * for the avr-libc routines. That is an estimate, not a measurement,
+ * which needs simavr or the hardware.
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "adc.h"
+#include "expfilter.h"
+
+const uint16_t SAMPLE_HZ = ADC_CONVERSION_RATE / 2;  // as in gate-detector.ino
+
+typedef ExpFilter<SAMPLE_HZ, 1000, 12> SlowFilter;
+typedef ExpFilter<SAMPLE_HZ, 2, 6> FastFilter;
+typedef ExpFilter<SAMPLE_HZ, 500, 12> NoiseFilter;
+
+// soft-float library calls of each kind
+enum FloatOp { FLOAT_ADD, FLOAT_MUL, FLOAT_CMP, FLOAT_CONVERT, FLOAT_OPS };
+static uint32_t sFloatOps[FLOAT_OPS];
+
+/***
+ * Rough cycles per call of __addsf3 (also used to subtract), __mulsf3,
+ * __cmpsf2 and __floatsisf on an ATmega328, which has a hardware
+ * multiply. They vary with the operands and the library version and
+ * are set at the low end, so the total is a lower bound.
+ */
+static const uint16_t FLOAT_CYCLES[FLOAT_OPS] = {100, 130, 40, 60};
+
+// a float that counts the arithmetic, compares and conversions done with it
+struct CountedFloat {
+  float f;
+  CountedFloat(float value = 0) : f(value) {}
+  CountedFloat(int value) : f(value) { sFloatOps[FLOAT_CONVERT]++; }
+  CountedFloat operator+(CountedFloat b) const { return op(FLOAT_ADD, f + b.f); }
+  CountedFloat operator-(CountedFloat b) const { return op(FLOAT_ADD, f - b.f); }
+  CountedFloat operator*(CountedFloat b) const { return op(FLOAT_MUL, f * b.f); }
+  bool operator<(CountedFloat b) const { return sFloatOps[FLOAT_CMP]++, f < b.f; }
+  bool operator>(CountedFloat b) const { return sFloatOps[FLOAT_CMP]++, f > b.f; }
+  static CountedFloat op(FloatOp kind, float value) {
+    sFloatOps[kind]++;
+    return CountedFloat(value);
+  }
+};
+
+class FloatFilter {
+ public:
+  FloatFilter(float tauSeconds, float value) : mAlpha(1.0f / (SAMPLE_HZ * tauSeconds)), mValue(value) {}
+  CountedFloat update(int16_t input) {
+    mValue = mValue + mAlpha * (CountedFloat(input) - mValue);
+    return mValue;
+  }
+  CountedFloat mAlpha;
+  CountedFloat mValue;
+};
+
+/***
+ * The fixed 1/4 and 3/4 hysteresis of the original detector, with the
+ * fast recovery of the slow filter. Returns the sample numbers at which
+ * the beam was seen to break.
+ */
+static std::vector<uint32_t> floatBreaks(const std::vector<int16_t> &trace) {
+  FloatFilter slow(1.000f, trace[0]);
+  FloatFilter fast(0.002f, trace[0]);
+  std::vector<uint32_t> breaks;
+  bool interrupted = false;
+  for (uint32_t i = 0; i < trace.size(); i++) {
+    slow.update(trace[i]);
+    fast.update(trace[i]);
+    if (slow.mValue < CountedFloat(10.0f)) {
+      continue;
+    }
+    if (fast.mValue > slow.mValue) {
+      slow.mValue = fast.mValue;
+    }
+    if (fast.mValue < CountedFloat(0.25f) * slow.mValue) {
+      if (not interrupted) {
+        breaks.push_back(i);
+      }
+      interrupted = true;
+    }
+    if (fast.mValue > CountedFloat(0.75f) * slow.mValue) {
+      interrupted = false;
+    }
+  }
+  return breaks;
+}
+
+// the same decisions with the integer filters and compares
+static std::vector<uint32_t> integerBreaks(const std::vector<int16_t> &trace) {
+  const uint8_t SLOW_SHIFT = SlowFilter::FRAC_BITS - FastFilter::FRAC_BITS;
+  SlowFilter slow(trace[0]);
+  FastFilter fast(trace[0]);
+  std::vector<uint32_t> breaks;
+  bool interrupted = false;
+  for (uint32_t i = 0; i < trace.size(); i++) {
+    slow.update(trace[i]);
+    fast.update(trace[i]);
+    int32_t slowValue = slow.raw() >> SLOW_SHIFT;
+    int32_t fastValue = fast.raw();
+    if (slowValue < 10 * FastFilter::ONE) {
+      continue;
+    }
+    if (fastValue > slowValue) {
+      slow.set_raw(fastValue << SLOW_SHIFT);
+      slowValue = fastValue;
+    }
+    if (4 * fastValue < slowValue) {
+      if (not interrupted) {
+        breaks.push_back(i);
+      }
+      interrupted = true;
+    }
+    if (4 * fastValue > 3 * slowValue) {
+      interrupted = false;
+    }
+  }
+  return breaks;
+}
+
+/***
+ * The largest difference between the integer and float filters over a
+ * trace, in ADC counts. Both start settled on the first reading.
+ */
+template <typename Filter>
+static float worstError(const std::vector<int16_t> &trace, float tauSeconds) {
+  Filter filter(trace[0]);
+  FloatFilter reference(tauSeconds, trace[0]);
+  float worst = 0;
+  for (int16_t input : trace) {
+    filter.update(input);
+    float error = fabsf((float)filter.raw() / Filter::ONE - reference.update(input).f);
+    if (error > worst) {
+      worst = error;
+    }
+  }
+  return worst;
+}
+
+static uint32_t sRandom;
+
+static uint32_t nextRandom(uint32_t range) {
+  sRandom = sRandom * 1664525UL + 1013904223UL;
+  return (sRandom >> 8) % range;
+}
+
+// roughly gaussian, from the sum of four uniform values
+static int16_t noise(uint16_t deviation) {
+  int32_t sum = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    sum += nextRandom(2 * deviation + 1);
+  }
+  return (int16_t)((sum - 4 * deviation) / 2);
+}
+
+static int16_t clampReading(int32_t value) {
+  return value < 0 ? 0 : value > 1023 ? 1023 : (int16_t)value;
+}
+
+static void add(std::vector<int16_t> &trace, uint32_t samples, int16_t level, uint16_t deviation) {
+  for (uint32_t i = 0; i < samples; i++) {
+    trace.push_back(clampReading(level + noise(deviation)));
+  }
+}
+
+static void ramp(std::vector<int16_t> &trace, uint32_t samples, int16_t from, int16_t to, uint16_t deviation) {
+  for (uint32_t i = 0; i < samples; i++) {
+    trace.push_back(clampReading(from + (int32_t)(to - from) * (int32_t)i / (int32_t)samples + noise(deviation)));
+  }
+}
+
+/***
+ * A gate lit at the given level with a mouse going through it every
+ * half second, at speeds from a crawl to a fast run, plus a slow fade
+ * of the lighting and some steps in it.
+ */
+static std::vector<int16_t> gateTrace(int16_t level, uint16_t deviation) {
+  std::vector<int16_t> trace;
+  add(trace, SAMPLE_HZ, level, deviation);
+  for (uint16_t edge = 1; edge <= 64; edge *= 2) {  // samples for the mouse to cover the beam
+    ramp(trace, edge, level, level / 10, deviation);
+    add(trace, 20 + 4 * edge, level / 10, deviation);
+    ramp(trace, edge, level / 10, level, deviation);
+    add(trace, SAMPLE_HZ / 2, level, deviation);
+  }
+  ramp(trace, 3 * SAMPLE_HZ, level, level * 2 / 3, deviation);
+  add(trace, SAMPLE_HZ, level * 2 / 3, deviation);
+  add(trace, SAMPLE_HZ, level, deviation);
+  add(trace, SAMPLE_HZ, level / 2, deviation);
+  add(trace, SAMPLE_HZ, level, deviation);
+  return trace;
+}
+
+static const int16_t LEVELS[] = {20, 60, 200, 500, 900};
+
+// replay a telemetry decoder CSV: sample,time_us,channel,value
+static bool readTrace(const char *path, uint8_t channel, std::vector<int16_t> &trace) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  char line[100];
+  unsigned long sample, time;
+  unsigned ch;
+  int value;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%lu,%lu,%u,%d", &sample, &time, &ch, &value) == 4 && ch == channel) {
+      trace.push_back(clampReading(value));
+    }
+  }
+  fclose(file);
+  return not trace.empty();
+}
+
+void setUp(void) {
+  sRandom = 12345;
+  memset(sFloatOps, 0, sizeof(sFloatOps));
+}
+
+void tearDown(void) {}
+
+// the alphas the compiler works out are the ones the float filter used
+void test_alpha(void) {
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 1.0, (double)SlowFilter::ALPHA / (1UL << SlowFilter::ALPHA_BITS) * SAMPLE_HZ * 1.000);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 1.0, (double)FastFilter::ALPHA / (1UL << FastFilter::ALPHA_BITS) * SAMPLE_HZ * 0.002);
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 1.0, (double)NoiseFilter::ALPHA / (1UL << NoiseFilter::ALPHA_BITS) * SAMPLE_HZ * 0.500);
+}
+
+/***
+ * The fast filter follows the float one closely. The slow filters make
+ * corrections so small that both versions have a dead band where the
+ * correction is lost in the rounding, about F*tau/2^FRAC_BITS counts
+ * for the integer one, so they are allowed to differ by that.
+ */
+void test_tracks_float_filter(void) {
+  const float SLOW_DEAD_BAND = (float)SAMPLE_HZ * 1.000f / SlowFilter::ONE;
+  const float NOISE_DEAD_BAND = (float)SAMPLE_HZ * 0.500f / NoiseFilter::ONE;
+  char message[100];
+  for (int16_t level : LEVELS) {
+    std::vector<int16_t> trace = gateTrace(level, 1 + level / 50);
+    float fast = worstError<FastFilter>(trace, 0.002f);
+    float slow = worstError<SlowFilter>(trace, 1.000f);
+    float noise = worstError<NoiseFilter>(trace, 0.500f);
+    snprintf(message, sizeof(message), "level %d: worst error fast %.3f slow %.3f noise %.3f counts", level, fast, slow, noise);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(0.1f, fast);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(SLOW_DEAD_BAND, slow);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(NOISE_DEAD_BAND, noise);
+  }
+}
+
+// the fixed 1/4 and 3/4 thresholds make the same decisions on the same samples
+void test_same_breaks(void) {
+  char message[100];
+  for (int16_t level : LEVELS) {
+    std::vector<int16_t> trace = gateTrace(level, 1 + level / 50);
+    std::vector<uint32_t> expected = floatBreaks(trace);
+    std::vector<uint32_t> actual = integerBreaks(trace);
+    snprintf(message, sizeof(message), "level %d: %zu breaks", level, expected.size());
+    TEST_MESSAGE(message);
+    TEST_ASSERT_GREATER_THAN(0, expected.size());
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      TEST_ASSERT_INT_WITHIN(1, expected[i], actual[i]);
+    }
+  }
+}
+
+/***
+ * What the float filters cost the ISR. Every sample went through two
+ * float filters and the threshold compares. Each count here is a call
+ * into the AVR soft-float library, which the integer filters no longer
+ * make. The cycles are compared with the time between conversions,
+ * which is all the ISR has for both sensors.
+ */
+void test_float_cost(void) {
+  std::vector<int16_t> trace = gateTrace(500, 10);
+  floatBreaks(trace);
+  const char *names[FLOAT_OPS] = {"add", "mul", "cmp", "convert"};
+  char message[160];
+  uint32_t calls = 0;
+  uint32_t cycles = 0;
+  for (uint8_t i = 0; i < FLOAT_OPS; i++) {
+    calls += sFloatOps[i];
+    cycles += sFloatOps[i] * FLOAT_CYCLES[i];
+    snprintf(message, sizeof(message), "%-8s %4.1f calls per sample, about %u cycles each", names[i],
+             (float)sFloatOps[i] / trace.size(), FLOAT_CYCLES[i]);
+    TEST_MESSAGE(message);
+  }
+  float perSample = (float)cycles / trace.size();
+  float conversionCycles = (float)F_CPU / ADC_CONVERSION_RATE;
+  snprintf(message, sizeof(message),
+           "float detector: %.1f calls, at least %.0f cycles (%.0fus at 8MHz) per sample, %.0f%% of the %.0f cycles between conversions",
+           (float)calls / trace.size(), perSample, perSample * 1e6f / F_CPU, 100 * perSample / conversionCycles, conversionCycles);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(1000, perSample);
+}
+
+void test_recorded_trace(void) {
+  const char *path = getenv("GATE_TRACE");
+  if (path == nullptr) {
+    TEST_IGNORE_MESSAGE("set GATE_TRACE to a telemetry decoder CSV file to replay it");
+  }
+  char message[100];
+  for (uint8_t channel = 0; channel < 2; channel++) {
+    std::vector<int16_t> trace;
+    if (not readTrace(path, channel, trace)) {
+      continue;
+    }
+    float fast = worstError<FastFilter>(trace, 0.002f);
+    std::vector<uint32_t> expected = floatBreaks(trace);
+    std::vector<uint32_t> actual = integerBreaks(trace);
+    snprintf(message, sizeof(message), "channel %d: %zu samples, %zu breaks, worst fast error %.3f counts", channel, trace.size(), expected.size(), fast);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(0.1f, fast);
+    TEST_ASSERT_EQUAL_UINT32(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      TEST_ASSERT_INT_WITHIN(1, expected[i], actual[i]);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_alpha);
+  RUN_TEST(test_tracks_float_filter);
+  RUN_TEST(test_same_breaks);
+  RUN_TEST(test_float_cost);
+  RUN_TEST(test_recorded_trace);
+  return UNITY_END();
+}
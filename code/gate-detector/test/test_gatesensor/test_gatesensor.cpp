@@ -0,0 +1,190 @@
+/***
+ * Event times from the gate sensor for mice at different speeds.
+ *
+ * A mouse cutting the beam looks like a ramp in the sensor reading,
+ * from the lit level down to the dark level. The faster the mouse, the
+ * steeper the ramp, and the fastest look like a step. The fast filter
+ * lags the ramp by an amount that depends on its slope so the sensor
+ * works out where the input itself crossed the threshold, see
+ * gatesensor.h. These tests check that the event time it reports,
+ * the time of the sample on which it triggered less mEventAge, is
+ * where the noiseless ramp crossed that threshold, with no bias that
+ * depends on the speed.
+ *
+ * Each occlusion starts at a random point in a sample period. A step
+ * can only be placed to within the sample period in which it happened,
+ * so the allowed error is one sample period. On a slow ramp the noise
+ * moves the crossing too, by the noise divided by the slope, so that
+ * is allowed as well. The mean error over many occlusions must be
+ * well inside half a sample period at every speed.
+ *
+ * The readings are synthetic with a little noise. Each sensor is
+ * sampled at the rate the detector uses.
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include "adc.h"
+#include "gatesensor.h"
+
+const uint16_t SAMPLE_HZ = ADC_CONVERSION_RATE / 2;  // as in gate-detector.ino
+const double SAMPLE_US = 1e6 / SAMPLE_HZ;
+const uint16_t OCCLUSIONS = 50;  // at each speed
+const uint16_t NOISE = 2;        // counts either way
+const uint16_t DARK_MS = 30;     // how long the beam stays cut
+
+// how long the mouse takes to cut the beam, 0 is a step
+static const double RAMP_MS[] = {0, 0.25, 0.5, 1, 2, 5, 10, 20};
+static const int16_t LEVELS[] = {100, 600};
+
+static uint32_t sRandom;
+static uint32_t sSample;  // the number of the next sample
+
+static uint32_t nextRandom(uint32_t range) {
+  sRandom = sRandom * 1664525UL + 1013904223UL;
+  return (sRandom >> 8) % range;
+}
+
+static int16_t noise() {
+  return (int16_t)nextRandom(2 * NOISE + 1) - NOISE;
+}
+
+static double sampleTime(uint32_t sample) {
+  return sample * SAMPLE_US;
+}
+
+// the noiseless reading at a time in microseconds
+static double beam(double time, double start, double rampUs, int16_t level) {
+  double dark = level / 10.0;
+  if (time < start) {
+    return level;
+  }
+  if (time >= start + rampUs) {
+    return dark;
+  }
+  return level - (level - dark) * (time - start) / rampUs;
+}
+
+template <typename Sensor>
+static bool feed(Sensor &sensor, double value) {
+  int16_t reading = (int16_t)lround(value) + noise();
+  sSample++;
+  return sensor.update(reading < 0 ? 0 : reading);
+}
+
+// light the gate and calibrate, then let the noise filter settle
+template <typename Sensor>
+static void light(Sensor &sensor, int16_t level) {
+  while (not sensor.calibrate()) {
+    feed(sensor, level);
+  }
+  for (uint32_t i = 0; i < SAMPLE_HZ; i++) {
+    TEST_ASSERT_FALSE(feed(sensor, level));
+  }
+}
+
+struct Errors {
+  double mean;
+  double worst;
+};
+
+/***
+ * Cut the beam OCCLUSIONS times with ramps of the given length and
+ * compare the event times with the true crossings, in microseconds.
+ */
+template <typename Sensor>
+static Errors occlusions(Sensor &sensor, int16_t level, double rampMs) {
+  Errors errors = {0, 0};
+  double rampUs = rampMs * 1000;
+  for (uint16_t n = 0; n < OCCLUSIONS; n++) {
+    double start = sampleTime(sSample + 10) + nextRandom(1000) * SAMPLE_US / 1000;
+    double end = start + rampUs + DARK_MS * 1000;
+    uint8_t breaks = 0;
+    double error = 0;
+    while (sampleTime(sSample) < end) {
+      double time = sampleTime(sSample);
+      if (feed(sensor, beam(time, start, rampUs, level))) {
+        breaks++;
+        double threshold = (double)((sensor.slow.raw() >> Sensor::SLOW_SHIFT) - sensor.mTrigger) / Sensor::ONE_COUNT;
+        double crossing = start + rampUs * (level - threshold) / (level - level / 10.0);
+        error = time - sensor.mEventAge - crossing;
+      }
+    }
+    TEST_ASSERT_EQUAL_UINT8(1, breaks);
+    errors.mean += error / OCCLUSIONS;
+    if (fabs(error) > fabs(errors.worst)) {
+      errors.worst = error;
+    }
+    // the beam comes back and the sensor re-arms
+    for (uint32_t i = 0; i < SAMPLE_HZ / 4; i++) {
+      TEST_ASSERT_FALSE(feed(sensor, level));
+    }
+  }
+  return errors;
+}
+
+template <typename Prefilter>
+static void checkSpeeds(const char *name) {
+  char message[120];
+  for (int16_t level : LEVELS) {
+    GateSensor<SAMPLE_HZ, Prefilter> sensor(A0);
+    light(sensor, level);
+    double lowest = 1e9;
+    double highest = -1e9;
+    for (double rampMs : RAMP_MS) {
+      Errors errors = occlusions(sensor, level, rampMs);
+      snprintf(message, sizeof(message), "%s level %d, %5.2fms ramp: mean error %6.1fus, worst %6.1fus", name, level, rampMs,
+               errors.mean, errors.worst);
+      TEST_MESSAGE(message);
+      double jitter = NOISE * rampMs * 1000 / (level - level / 10.0);
+      TEST_ASSERT_FLOAT_WITHIN(SAMPLE_US + jitter, 0, errors.worst);
+      TEST_ASSERT_FLOAT_WITHIN(SAMPLE_US / 2, 0, errors.mean);
+      lowest = fmin(lowest, errors.mean);
+      highest = fmax(highest, errors.mean);
+    }
+    // the bias does not depend on the speed
+    TEST_ASSERT_LESS_OR_EQUAL_FLOAT(SAMPLE_US / 2, highest - lowest);
+  }
+}
+
+void setUp(void) {
+  sRandom = 12345;
+  sSample = 0;
+}
+
+void tearDown(void) {}
+
+void test_no_prefilter(void) {
+  checkSpeeds<NoPrefilter>("none");
+}
+
+// as in gate-detector.ino
+void test_bright_blanker(void) {
+  checkSpeeds<BrightBlanker<8>>("blanker");
+}
+
+// the median delays every edge, which is added to the event age
+void test_median_prefilter(void) {
+  checkSpeeds<MedianPrefilter<3>>("median3");
+}
+
+// a crawling mouse is timed from where the input crossed, not from the history limit
+void test_event_age_inside_history(void) {
+  typedef GateSensor<SAMPLE_HZ, NoPrefilter> Sensor;
+  Sensor sensor(A0);
+  light(sensor, 600);
+  double start = sampleTime(sSample) + SAMPLE_US / 2;
+  while (not feed(sensor, beam(sampleTime(sSample), start, 20000, 600))) {
+    TEST_ASSERT_LESS_THAN(start + 20000, sampleTime(sSample));
+  }
+  TEST_ASSERT_LESS_THAN((uint32_t)(Sensor::HISTORY_SIZE * SAMPLE_US), sensor.mEventAge);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_prefilter);
+  RUN_TEST(test_bright_blanker);
+  RUN_TEST(test_median_prefilter);
+  RUN_TEST(test_event_age_inside_history);
+  return UNITY_END();
+}
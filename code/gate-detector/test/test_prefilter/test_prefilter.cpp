@@ -0,0 +1,220 @@
+/***
+ * The prefilters against bright interference, see prefilter.h.
+ *
+ * A lit gate is exposed to robot emitters pulsing at 1kHz and to camera
+ * flashes, with no mouse anywhere near it. Any break is a false
+ * trigger. Then mice go through the gate, with and without a robot
+ * emitter pulsing on the sensor as they do, and the trigger times are
+ * compared with those of a sensor that has no prefilter. The
+ * difference is the latency that the prefilter adds to the detection.
+ *
+ * The sensor samples the light at single instants so a pulse is seen
+ * by whichever samples happen to fall inside it. The pulses are not
+ * locked to the sample clock.
+ *
+ * The results for every prefilter are printed. The assertions are on
+ * the BrightBlanker<8> that gate-detector.ino uses: no false triggers,
+ * every mouse seen and no added latency.
+ */
+
+#include <unity.h>
+#include <stdio.h>
+#include "adc.h"
+#include "gatesensor.h"
+
+const uint16_t SAMPLE_HZ = ADC_CONVERSION_RATE / 2;  // as in gate-detector.ino
+const double SAMPLE_US = 1e6 / SAMPLE_HZ;
+const int16_t LEVEL = 300;
+const int16_t DARK = 30;
+const uint16_t NOISE = 2;  // counts either way
+const uint32_t SECONDS = 10;
+const uint16_t MICE = 40;
+
+static uint32_t sRandom;
+
+static uint32_t nextRandom(uint32_t range) {
+  sRandom = sRandom * 1664525UL + 1013904223UL;
+  return (sRandom >> 8) % range;
+}
+
+static int16_t noise() {
+  return (int16_t)nextRandom(2 * NOISE + 1) - NOISE;
+}
+
+/***
+ * A light source that adds to the reading while it is on. It is on for
+ * width microseconds every period, starting at phase.
+ */
+struct Pulses {
+  double period;
+  double width;
+  int16_t brightness;
+  double phase;
+
+  int16_t at(double time) const {
+    if (period == 0 || time < phase) {
+      return 0;
+    }
+    return fmod(time - phase, period) < width ? brightness : 0;
+  }
+};
+
+const Pulses NONE = {0, 0, 0, 0};
+const Pulses ROBOT = {1000, 150, 400, 37};          // 1kHz emitter, 15% duty
+const Pulses ROBOT_WIDE = {1000, 450, 400, 37};     // 1kHz emitter, 45% duty
+const Pulses FLASH = {250000, 1000, 1023, 50000};   // camera flash four times a second
+const Pulses LONG_FLASH = {250000, 1600, 1023, 50000};
+
+struct Result {
+  uint16_t falseTriggers;
+  uint16_t missed;
+  double latency;  // mean, in samples, against no prefilter
+};
+
+static int16_t reading(double light, const Pulses &pulses, double time) {
+  int32_t value = lround(light) + pulses.at(time) + noise();
+  return value < 0 ? 0 : value > 1023 ? 1023 : (int16_t)value;
+}
+
+template <typename Sensor>
+static uint32_t calibrate(Sensor &sensor) {
+  uint32_t sample = 0;
+  while (not sensor.calibrate()) {
+    sensor.update(reading(LEVEL, NONE, sample++ * SAMPLE_US));
+  }
+  for (uint32_t i = 0; i < SAMPLE_HZ; i++) {
+    sensor.update(reading(LEVEL, NONE, sample++ * SAMPLE_US));
+  }
+  return sample;
+}
+
+// count the breaks on a lit gate under interference
+template <typename Prefilter>
+static uint16_t falseTriggers(const Pulses &pulses) {
+  GateSensor<SAMPLE_HZ, Prefilter> sensor(A0);
+  uint32_t sample = calibrate(sensor);
+  uint16_t breaks = 0;
+  for (uint32_t i = 0; i < SECONDS * SAMPLE_HZ; i++, sample++) {
+    breaks += sensor.update(reading(LEVEL, pulses, sample * SAMPLE_US));
+  }
+  return breaks;
+}
+
+/***
+ * Mice cut the beam in 0.5ms to 5ms and stay in it for 30ms, once
+ * every half second. The reference sensor has no prefilter and sees
+ * the same readings with no interference. Returns the trigger samples
+ * relative to the reference, averaged over the mice both of them saw.
+ */
+template <typename Prefilter>
+static Result mice(const Pulses &pulses) {
+  GateSensor<SAMPLE_HZ, Prefilter> sensor(A0);
+  GateSensor<SAMPLE_HZ, NoPrefilter> reference(A0);
+  // both see the same calibration readings
+  sRandom = 12345;
+  calibrate(sensor);
+  sRandom = 12345;
+  uint32_t sample = calibrate(reference);
+  Result result = {0, 0, 0};
+  uint16_t timed = 0;
+  for (uint16_t mouse = 0; mouse < MICE; mouse++) {
+    double start = (sample + SAMPLE_HZ / 4) * SAMPLE_US + nextRandom(1000) * SAMPLE_US / 1000;
+    double ramp = 500 + nextRandom(4500);
+    uint32_t end = sample + SAMPLE_HZ / 2;
+    int32_t triggered = -1;
+    int32_t expected = -1;
+    for (; sample < end; sample++) {
+      double time = sample * SAMPLE_US;
+      double light = time < start ? LEVEL : time < start + ramp ? LEVEL - (LEVEL - DARK) * (time - start) / ramp : DARK;
+      if (time > start + ramp + 30000) {
+        light = LEVEL;
+      }
+      int16_t clean = reading(light, NONE, time);
+      int16_t value = clean + pulses.at(time);
+      if (sensor.update(value > 1023 ? 1023 : value)) {
+        if (triggered < 0 && time >= start) {
+          triggered = sample;
+        } else {
+          result.falseTriggers++;
+        }
+      }
+      if (reference.update(clean) && expected < 0) {
+        expected = sample;
+      }
+    }
+    if (triggered < 0) {
+      result.missed++;
+    } else if (expected >= 0) {
+      result.latency += triggered - expected;
+      timed++;
+    }
+  }
+  if (timed > 0) {
+    result.latency /= timed;
+  }
+  return result;
+}
+
+template <typename Prefilter>
+static void report(const char *name) {
+  char message[200];
+  uint16_t robot = falseTriggers<Prefilter>(ROBOT);
+  uint16_t robotWide = falseTriggers<Prefilter>(ROBOT_WIDE);
+  uint16_t flash = falseTriggers<Prefilter>(FLASH);
+  uint16_t longFlash = falseTriggers<Prefilter>(LONG_FLASH);
+  Result clean = mice<Prefilter>(NONE);
+  Result robotMice = mice<Prefilter>(ROBOT);
+  snprintf(message, sizeof(message),
+           "%-16s false triggers in %lus: robot %3u wide %3u flash %3u long flash %3u | mice missed %u/%u extra breaks %u latency %+.2f samples",
+           name, (unsigned long)SECONDS, robot, robotWide, flash, longFlash, clean.missed + robotMice.missed, 2 * MICE,
+           clean.falseTriggers + robotMice.falseTriggers, clean.latency);
+  TEST_MESSAGE(message);
+}
+
+void setUp(void) {
+  sRandom = 12345;
+}
+
+void tearDown(void) {}
+
+void test_compare_prefilters(void) {
+  report<NoPrefilter>("none");
+  report<MedianPrefilter<3>>("median3");
+  report<MedianPrefilter<5>>("median5");
+  report<BrightBlanker<8>>("blanker8");
+  report<PrefilterChain<MedianPrefilter<3>, BrightBlanker<8>>>("median3+blanker8");
+}
+
+// the prefilter in gate-detector.ino
+typedef BrightBlanker<8> Chosen;
+
+void test_no_false_triggers(void) {
+  TEST_ASSERT_EQUAL_UINT16(0, falseTriggers<Chosen>(NONE));
+  TEST_ASSERT_EQUAL_UINT16(0, falseTriggers<Chosen>(ROBOT));
+  TEST_ASSERT_EQUAL_UINT16(0, falseTriggers<Chosen>(ROBOT_WIDE));
+  TEST_ASSERT_EQUAL_UINT16(0, falseTriggers<Chosen>(FLASH));
+  TEST_ASSERT_EQUAL_UINT16(0, falseTriggers<Chosen>(LONG_FLASH));
+}
+
+void test_no_added_latency(void) {
+  Result result = mice<Chosen>(NONE);
+  TEST_ASSERT_EQUAL_UINT16(0, result.missed);
+  TEST_ASSERT_EQUAL_UINT16(0, result.falseTriggers);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, result.latency);
+}
+
+// a robot pulsing its emitter on the sensor as it goes through
+void test_robot_in_the_gate(void) {
+  Result result = mice<Chosen>(ROBOT);
+  TEST_ASSERT_EQUAL_UINT16(0, result.missed);
+  TEST_ASSERT_EQUAL_UINT16(0, result.falseTriggers);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_compare_prefilters);
+  RUN_TEST(test_no_false_triggers);
+  RUN_TEST(test_no_added_latency);
+  RUN_TEST(test_robot_in_the_gate);
+  return UNITY_END();
+}
@@ -0,0 +1,309 @@
+/***
+ * Stand in for the host PC on the controller serial link.
+ *
+ *   host-stand-in [-d percent] [-s seed] device
+ *   host-stand-in [-d percent] [-s seed] -p
+ *
+ * Reads messages from the gate controller, in either the text or the
+ * binary format, prints them and acknowledges the ones that ask for
+ * it. It turns acknowledgements on with a bare ! line at the start
+ * and after every watchdog. A repeated sequence number is acknowledged again but the message
+ * is not taken a second time. With -d, each message that asks for an
+ * acknowledgement is lost on the way in, and each acknowledgement is
+ * lost on the way out, with the given percentage chance. That shows
+ * that run results still arrive exactly once.
+ *
+ * device is the controller serial port, which is set to 115200 baud.
+ * With -p a pseudo-terminal is opened instead and the name of the
+ * other end is printed for a simulated controller to use.
+ *
+ * On Ctrl-C, or at the end of the input from a device, it prints
+ * every run time that was taken and a summary. The formats are
+ * described in the controller's hostlink.h.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const uint8_t SYNC0 = 0xA5;
+const uint8_t SYNC1 = 0x5A;
+const size_t BINARY_PAYLOAD = 13;
+const size_t BINARY_FRAME = 2 + 1 + BINARY_PAYLOAD + 1;
+const uint8_t TYPE_ACK = 0x80;
+const int HOST_WINDOW = 4;
+const int MSG_Watchdog = 0;
+const int MSG_C1RunTime = 13;
+const int MSG_ClockPpm = 60;
+const int MSG_GatePpm = 61;
+
+static volatile sig_atomic_t sStop = 0;
+
+static void onSignal(int) {
+  sStop = 1;
+}
+
+static uint8_t crc8(const uint8_t *data, size_t length) {
+  uint8_t crc = 0;
+  while (length--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+struct Stats {
+  unsigned messages = 0;
+  unsigned taken = 0;
+  unsigned duplicates = 0;
+  unsigned lostIn = 0;
+  unsigned lostOut = 0;
+  unsigned badFrames = 0;
+};
+
+class Host {
+ public:
+  Host(int fd, int dropPercent) : mFd(fd), mDropPercent(dropPercent) { memset(mSeen, 0, sizeof(mSeen)); }
+
+  // acknowledgements stay off until the controller hears this
+  void turnOnAcks() { send("!\r\n"); }
+
+  /***
+   * Handle one message. Taking a new sequence number forgets the ones
+   * from HOST_WINDOW to half the range ahead of it, which were last
+   * used the time round before, so they can be taken again.
+   */
+  void message(int type, uint32_t value, int sequence, bool needsAck, const std::string &text) {
+    mStats.messages++;
+    if (not needsAck) {
+      printf("%s\n", text.c_str());
+      if (type == MSG_Watchdog) {
+        turnOnAcks();
+      }
+      return;
+    }
+    if (lose()) {
+      mStats.lostIn++;
+      printf("%s  [lost]\n", text.c_str());
+      return;
+    }
+    if (mSeen[sequence]) {
+      mStats.duplicates++;
+      printf("%s  [duplicate]\n", text.c_str());
+    } else {
+      mSeen[sequence] = true;
+      for (int n = HOST_WINDOW; n <= 128; n++) {
+        mSeen[(sequence + n) & 0xFF] = false;
+      }
+      mStats.taken++;
+      printf("%s  [taken]\n", text.c_str());
+      if (type == MSG_C1RunTime) {
+        mRunTimes.push_back(value);
+      }
+    }
+    if (lose()) {
+      mStats.lostOut++;
+      printf("  ack %d [lost]\n", sequence);
+      return;
+    }
+    char ack[8];
+    snprintf(ack, sizeof(ack), "!%d\r\n", sequence);
+    send(ack);
+  }
+
+  void badFrame() { mStats.badFrames++; }
+
+  void summary() const {
+    printf("run times taken:");
+    for (uint32_t t : mRunTimes) {
+      printf(" %u", t);
+    }
+    printf("\n");
+    fprintf(stderr, "%u messages, %u taken, %u duplicates, %u lost in, %u acks lost, %u bad frames\n", mStats.messages, mStats.taken,
+            mStats.duplicates, mStats.lostIn, mStats.lostOut, mStats.badFrames);
+  }
+
+ private:
+  bool lose() { return mDropPercent > 0 && rand() % 100 < mDropPercent; }
+
+  void send(const char *text) {
+    ssize_t length = strlen(text);
+    if (write(mFd, text, length) != length) {
+      perror("write");
+    }
+  }
+
+  int mFd;
+  int mDropPercent;
+  bool mSeen[256];
+  Stats mStats;
+  std::vector<uint32_t> mRunTimes;
+};
+
+/***
+ * A text message is <type,value> with an optional #sequence straight
+ * after the '>'. Anything else on the line is printed as it is.
+ */
+static void textLine(Host &host, const std::string &line) {
+  unsigned type;
+  unsigned long value;
+  int used = 0;
+  if (sscanf(line.c_str(), "<%u,%lu>%n", &type, &value, &used) != 2 || used == 0) {
+    if (not line.empty()) {
+      printf("%s\n", line.c_str());
+    }
+    return;
+  }
+  int sequence = -1;
+  if (line[used] == '#') {
+    sequence = atoi(line.c_str() + used + 1) & 0xFF;
+  }
+  host.message(type, value, sequence, sequence >= 0, line);
+}
+
+static void binaryFrame(Host &host, const uint8_t *frame) {
+  uint8_t sequence = frame[3];
+  uint8_t type = frame[4];
+  uint32_t value = frame[5] | (frame[6] << 8) | (frame[7] << 16) | ((uint32_t)frame[8] << 24);
+  uint64_t time = 0;
+  for (int i = 5; i >= 0; i--) {
+    time = (time << 8) | frame[9 + i];
+  }
+  // the clock errors are the only signed values
+  bool isSigned = (type & ~TYPE_ACK) == MSG_ClockPpm || (type & ~TYPE_ACK) == MSG_GatePpm;
+  char text[80];
+  int length = snprintf(text, sizeof(text), isSigned ? "[%llu.%06llu] seq %u <%u,%d>" : "[%llu.%06llu] seq %u <%u,%u>",
+                        (unsigned long long)(time / 1000000), (unsigned long long)(time % 1000000), sequence, type & ~TYPE_ACK, value);
+  if (frame[15]) {
+    snprintf(text + length, sizeof(text) - length, " %c", frame[15]);
+  }
+  host.message(type & ~TYPE_ACK, value, sequence, (type & TYPE_ACK) != 0, text);
+}
+
+/***
+ * Binary frames are picked out by their sync bytes and CRC. Everything
+ * else is taken as lines of text.
+ */
+static void parse(Host &host, std::vector<uint8_t> &buffer, std::string &line) {
+  size_t i = 0;
+  while (i < buffer.size()) {
+    if (buffer[i] == SYNC0) {
+      if (buffer.size() - i < BINARY_FRAME) {
+        break;  // wait for the rest
+      }
+      const uint8_t *frame = &buffer[i];
+      if (frame[1] == SYNC1 && frame[2] == BINARY_PAYLOAD && crc8(frame + 2, 1 + BINARY_PAYLOAD) == frame[BINARY_FRAME - 1]) {
+        binaryFrame(host, frame);
+        i += BINARY_FRAME;
+        continue;
+      }
+      host.badFrame();
+    }
+    char c = buffer[i++];
+    if (c == '\n') {
+      textLine(host, line);
+      line.clear();
+    } else if (c != '\r') {
+      line += c;
+    }
+  }
+  buffer.erase(buffer.begin(), buffer.begin() + i);
+}
+
+static int openDevice(const char *path) {
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B115200);
+    cfsetospeed(&tio, B115200);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+static int openPty() {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    perror("pseudo-terminal");
+    return -1;
+  }
+  // Keep the line discipline out of the way of binary frames. This end
+  // stays open so reads wait, rather than fail, until the controller
+  // connects.
+  struct termios tio;
+  int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+  if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+  }
+  printf("controller side: %s\n", ptsname(fd));
+  fflush(stdout);
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  int dropPercent = 0;
+  bool pty = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:p")) != -1) {
+    switch (opt) {
+      case 'd':
+        dropPercent = atoi(optarg);
+        break;
+      case 's':
+        srand(atoi(optarg));
+        break;
+      case 'p':
+        pty = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-d percent] [-s seed] device | -p\n", argv[0]);
+        return 2;
+    }
+  }
+  if (pty == (optind < argc)) {
+    fprintf(stderr, "usage: %s [-d percent] [-s seed] device | -p\n", argv[0]);
+    return 2;
+  }
+  int fd = pty ? openPty() : openDevice(argv[optind]);
+  if (fd < 0) {
+    return 1;
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  Host host(fd, dropPercent);
+  host.turnOnAcks();
+  std::vector<uint8_t> buffer;
+  std::string line;
+  uint8_t chunk[256];
+  while (not sStop) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+      break;  // end of input, or the other end of the pseudo-terminal closed
+    }
+    buffer.insert(buffer.end(), chunk, chunk + n);
+    parse(host, buffer, line);
+    fflush(stdout);
+  }
+  host.summary();
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,156 @@
+/***
+ * Decode a gate controller SD card journal into a CSV file.
+ *
+ *   journal-decoder JRNL0000.BIN [journal.csv]
+ *
+ * The output has one line for each record:
+ *
+ *   block,time_us,record,detail
+ *
+ * where time_us is on the corrected controller clock, in microseconds
+ * since the controller started. The detail depends on the record:
+ *
+ *   HEADER   the wall clock when the block was started
+ *   RADIO    the character, or its hex code if it is not printable
+ *   EVENT    the gate character and the confidence
+ *   STATE    the new contest state
+ *   MESSAGE  the message type and value sent to the host
+ *
+ * The journal is preallocated and the controller erases ahead of its
+ * writes, so it ends at the first block that does not have the right
+ * header. The file format is
+ * described in the controller's journal.h.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+const size_t BLOCK_SIZE = 512;
+const size_t HEADER_SIZE = 24;
+enum { END = 0, RADIO = 1, EVENT, STATE, MESSAGE, HEADER = 'J' };
+
+static uint64_t little(const uint8_t *p, int bytes) {
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+struct Header {
+  bool valid;
+  uint16_t file;
+  uint32_t block;
+  uint32_t ticks;
+  uint64_t micros;
+};
+
+static Header header(const uint8_t *b) {
+  Header h;
+  h.valid = b[0] == 'J' && b[1] == 'L';
+  h.file = little(b + 2, 2);
+  h.block = little(b + 4, 4);
+  h.ticks = little(b + 8, 4);
+  h.micros = little(b + 12, 6);
+  return h;
+}
+
+/***
+ * Records carry the raw half microsecond ticks. Each one is unwrapped
+ * from the one before and converted with the rate between this block
+ * header and the next, which takes out the controller clock error.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s JRNL0000.BIN [journal.csv]\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    data.push_back((uint8_t)c);
+  }
+  fclose(in);
+  FILE *out = stdout;
+  if (argc == 3) {
+    out = fopen(argv[2], "w");
+    if (out == NULL) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+  fprintf(out, "block,time_us,record,detail\n");
+
+  size_t blocks = data.size() / BLOCK_SIZE;
+  if (blocks == 0) {
+    fprintf(stderr, "%s: not a journal\n", argv[1]);
+    return 1;
+  }
+  Header first = header(&data[0]);
+  uint64_t records = 0;
+  double rate = 0.5;  // corrected microseconds per tick
+  size_t block = 0;
+  for (; block < blocks; block++) {
+    const uint8_t *b = &data[block * BLOCK_SIZE];
+    Header h = header(b);
+    if (not h.valid || h.file != first.file || h.block != block) {
+      break;
+    }
+    if (block + 1 < blocks) {
+      Header next = header(b + BLOCK_SIZE);
+      int32_t span = (int32_t)(next.ticks - h.ticks);
+      if (next.valid && next.file == h.file && next.block == block + 1 && span > 0) {
+        rate = (double)(next.micros - h.micros) / span;
+      }
+    }
+    fprintf(out, "%zu,%llu,HEADER,%04d-%02d-%02d %02d:%02d:%02d\n", block, (unsigned long long)h.micros, 2000 + b[18], b[19], b[20], b[21], b[22],
+            b[23]);
+    int64_t ticks = 0;  // since the header
+    uint32_t last = h.ticks;
+    size_t i = HEADER_SIZE;
+    while (i + 5 <= BLOCK_SIZE && b[i] != END) {
+      uint8_t kind = b[i];
+      uint32_t t = little(b + i + 1, 4);
+      ticks += (int32_t)(t - last);
+      last = t;
+      long long time = (long long)h.micros + (long long)(ticks * rate);
+      const uint8_t *p = b + i + 5;
+      size_t size = kind == RADIO ? 1 : kind == EVENT ? 2 : kind == STATE ? 1 : kind == MESSAGE ? 5 : 0;
+      if (size == 0 || i + 5 + size > BLOCK_SIZE) {
+        fprintf(stderr, "block %zu: bad record at %zu\n", block, i);
+        break;
+      }
+      switch (kind) {
+        case RADIO:
+          if (p[0] >= ' ' && p[0] < 127 && p[0] != ',') {
+            fprintf(out, "%zu,%lld,RADIO,%c\n", block, time, p[0]);
+          } else {
+            fprintf(out, "%zu,%lld,RADIO,0x%02X\n", block, time, p[0]);
+          }
+          break;
+        case EVENT:
+          fprintf(out, "%zu,%lld,EVENT,%c %u\n", block, time, p[0], p[1]);
+          break;
+        case STATE:
+          fprintf(out, "%zu,%lld,STATE,%u\n", block, time, p[0]);
+          break;
+        case MESSAGE:
+          fprintf(out, "%zu,%lld,MESSAGE,%u %u\n", block, time, p[0], (uint32_t)little(p + 1, 4));
+          break;
+      }
+      records++;
+      i += 5 + size;
+    }
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "journal %u: %zu blocks, %llu records\n", first.file, block, (unsigned long long)records);
+  return 0;
+}
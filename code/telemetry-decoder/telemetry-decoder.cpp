@@ -0,0 +1,181 @@
+/***
+ * Decode a gate detector telemetry capture into a CSV file.
+ *
+ *   telemetry-decoder capture.bin [samples.csv]
+ *
+ * The capture is the raw byte stream from the detector serial port
+ * with DEBUG set to 2. Any text before or between frames is skipped.
+ * The output has one line for each reading:
+ *
+ *   sample,time_us,channel,value
+ *
+ * where sample counts every reading since the detector started and
+ * time_us is that count multiplied by the 104us conversion time.
+ * Channel 0 is the side sensor and channel 1 is the end sensor.
+ *
+ * Dropped readings, damaged frames and lost frames are reported on
+ * stderr with a summary at the end. The file format is described in
+ * the detector's telemetry.h.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+const uint8_t SYNC0 = 0xA5;
+const uint8_t SYNC1 = 0x5A;
+const size_t HEADER_SIZE = 9;
+const uint8_t NIBBLE_ESCAPE = 0x8;
+const uint32_t SAMPLE_TIME_US = 104;  // 13 ADC clocks at 8MHz / 64
+
+static uint8_t crc8(const uint8_t *data, size_t length) {
+  uint8_t crc = 0;
+  while (length--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+struct Stats {
+  uint64_t frames = 0;
+  uint64_t samples = 0;
+  uint64_t dropped = 0;
+  uint64_t badFrames = 0;
+  uint64_t skippedBytes = 0;
+};
+
+/***
+ * Decode one frame payload. Returns false if the nibbles do not make
+ * up exactly the number of samples given in the header.
+ */
+static bool decodePayload(const uint8_t *payload, size_t length, uint32_t counter, uint8_t info, FILE *out) {
+  uint8_t count = info & 0x7F;
+  int channel = info >> 7;
+  size_t nibbles = length * 2;
+  size_t n = 0;
+  auto nibble = [&]() -> int { uint8_t b = payload[n / 2]; int v = (n & 1) ? (b >> 4) : (b & 0x0F); n++; return v; };
+  int last[2] = {-1, -1};
+  std::vector<int> values;
+  for (uint8_t i = 0; i < count; i++) {
+    if (n >= nibbles) {
+      return false;
+    }
+    int code = nibble();
+    int value;
+    if (code == NIBBLE_ESCAPE) {
+      if (n + 3 > nibbles) {
+        return false;
+      }
+      value = nibble();
+      value |= nibble() << 4;
+      value |= (nibble() & 0x03) << 8;
+    } else {
+      if (last[channel] < 0) {
+        return false;
+      }
+      value = last[channel] + ((code & 0x08) ? code - 16 : code);
+    }
+    last[channel] = value;
+    values.push_back(value);
+    channel ^= 1;
+  }
+  // only a padding nibble may be left over
+  if (nibbles - n > 1) {
+    return false;
+  }
+  channel = info >> 7;
+  for (size_t i = 0; i < values.size(); i++) {
+    uint64_t sample = (uint64_t)counter + i;
+    fprintf(out, "%llu,%llu,%d,%d\n", (unsigned long long)sample, (unsigned long long)(sample * SAMPLE_TIME_US), channel, values[i]);
+    channel ^= 1;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s capture.bin [samples.csv]\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  int c;
+  while ((c = fgetc(in)) != EOF) {
+    data.push_back((uint8_t)c);
+  }
+  fclose(in);
+  FILE *out = stdout;
+  if (argc == 3) {
+    out = fopen(argv[2], "w");
+    if (out == NULL) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+  fprintf(out, "sample,time_us,channel,value\n");
+
+  Stats stats;
+  bool started = false;
+  uint32_t expected = 0;
+  uint8_t expectedSequence = 0;
+  size_t i = 0;
+  while (i + HEADER_SIZE + 1 <= data.size()) {
+    if (data[i] != SYNC0 || data[i + 1] != SYNC1) {
+      i++;
+      stats.skippedBytes++;
+      continue;
+    }
+    size_t length = data[i + 2];
+    size_t frameSize = HEADER_SIZE + length + 1;
+    if (i + frameSize > data.size()) {
+      break;  // truncated at the end of the capture
+    }
+    const uint8_t *frame = &data[i];
+    uint8_t info = frame[8];
+    if ((info & 0x7F) == 0 || crc8(frame + 2, HEADER_SIZE - 2 + length) != frame[HEADER_SIZE + length]) {
+      // not a frame after all, or a damaged one - look for the next sync
+      stats.badFrames++;
+      i++;
+      continue;
+    }
+    uint8_t sequence = frame[3];
+    uint32_t counter = frame[4] | (frame[5] << 8) | (frame[6] << 16) | ((uint32_t)frame[7] << 24);
+    if (not decodePayload(frame + HEADER_SIZE, length, counter, info, out)) {
+      stats.badFrames++;
+      i++;
+      continue;
+    }
+    if (started) {
+      if (sequence != expectedSequence) {
+        fprintf(stderr, "frame %u: %u frames lost\n", sequence, (uint8_t)(sequence - expectedSequence));
+      }
+      if (counter != expected) {
+        int64_t gap = (int64_t)counter - expected;
+        fprintf(stderr, "sample %u: %lld samples missing\n", counter, (long long)gap);
+        if (gap > 0) {
+          stats.dropped += gap;
+        }
+      }
+    }
+    started = true;
+    expectedSequence = sequence + 1;
+    expected = counter + (info & 0x7F);
+    stats.frames++;
+    stats.samples += info & 0x7F;
+    i += frameSize;
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "%llu frames, %llu samples, %llu missing, %llu bad frames, %llu bytes skipped\n", (unsigned long long)stats.frames,
+          (unsigned long long)stats.samples, (unsigned long long)stats.dropped, (unsigned long long)stats.badFrames,
+          (unsigned long long)stats.skippedBytes);
+  return 0;
+}